@@ -2,7 +2,14 @@
  * rl_sched_mod.c
  *
  * Experimental RL-based scheduler prototype as a kernel module.
- * - Monitors processes periodically and uses simple Q-learning to adjust nice values.
+ * - Monitors processes periodically and uses tabular Q-learning (or SARSA, Double
+ *   Q-learning or Q(lambda), per the algo parameter) to adjust nice values
+ *   (or, per the actuator parameter, cgroup cpu.weight, the scheduling policy
+ *   or uclamp).
+ * - Tracks task lifetimes via the sched_process_{fork,exec,exit} tracepoints so
+ *   only live tasks are kept in the pid table and visited by the worker.
+ * - Optionally runs one worker per online CPU, each owning the tasks queued on
+ *   its CPU (percpu_workers=1).
  *
  * WARNING:
  *  - Experimental. Use only in test environments (VM).
@@ -16,7 +23,28 @@
  *   sudo rmmod rl_sched_mod
  *
  * Module parameters:
- *   alpha_permille, gamma_permille, epsilon_permille, interval_ms, action_step
+ *   algo, lambda_permille, alpha_permille, gamma_permille,
+ *   epsilon_permille, epsilon_decay,
+ *   epsilon_decay_k, epsilon_min_permille, interval_ms, interval_us,
+ *   action_step, max_actions_per_tick, min_dwell_ms, hysteresis,
+ *   max_entries, pool_size, scan_max_tasks, scan_budget_us, scan_batch, scope,
+ *   policy_share, max_policies, cpu_thresh_us, wait_thresh_us, vcsw_thresh,
+ *   ivcsw_thresh, util_thresh, reward_cpu_permille, reward_wait_permille,
+ *   reward_pressure_permille, adaptive_interval, interval_min_us,
+ *   interval_max_us, adapt_pressure_permille, adapt_qdelta, percpu_workers,
+ *   debug, dry_run, preload, actuator, weight_step_pct, uclamp_step, cgroup_root,
+ *   group_mode, group_task_agents, skip_kthreads, skip_rt, skip_idle
+ *
+ * Runtime state: /sys/kernel/rl_sched/ (task filter rules: filter;
+ *   learn/exploit/pause: mode; write reset to restore the original nice,
+ *   or whatever knob the actuator moves; also done on unload and when a
+ *   filter drops a task)
+ * Introspection: /sys/kernel/debug/rl_sched/{tasks,stats}
+ * Learned tables: /sys/kernel/debug/rl_sched/qtables (read = dump, write = load)
+ * Decisions: trace events rl_sched:rl_{observe,choose,q_update,actuate,
+ *   group_actuate}
+ *   (with dry_run=1 nothing is changed; rl_actuate then traces the changes
+ *   that would have been made)
  *
  */
 
@@ -26,13 +54,48 @@
 #include <linux/sched/signal.h>
 #include <linux/kthread.h>
 #include <linux/delay.h>
+#include <linux/hrtimer.h>
 #include <linux/slab.h>
 #include <linux/rcupdate.h>
 #include <linux/types.h>
 #include <linux/spinlock.h>
 #include <linux/uaccess.h>
 #include <linux/random.h>
+#include <linux/rhashtable.h>
+#include <linux/log2.h>
+#include <linux/llist.h>
+#include <linux/pid.h>
+#include <linux/pid_namespace.h>
+#include <linux/tracepoint.h>
+#include <linux/binfmts.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/atomic.h>
+#include <linux/cgroup.h>
+#include <linux/mm_types.h>
+#include <linux/fs.h>
+#include <linux/string.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/sched/loadavg.h>
+#include <linux/bitmap.h>
+#include <linux/vmalloc.h>
+#include <linux/cpu.h>
+#include <linux/cpuhotplug.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/jhash.h>
+#include <linux/mutex.h>
+#include <linux/sort.h>
+#include <linux/hashtable.h>
+#include <linux/kernel_read_file.h>
+#include <linux/file.h>
+#include <linux/cred.h>
+#include <uapi/linux/sched/types.h>
 
+#define CREATE_TRACE_POINTS
+#include "rl_sched_trace.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("OS-Project");
@@ -40,11 +103,70 @@ MODULE_DESCRIPTION("Experimental RL scheduler prototype - adjusts nice values us
 MODULE_VERSION("0.2");
 
 /* module parameters (scaled as permille integers, e.g. 200 = 0.200) */
+static int algo;                     /* enum rl_algo */
+static int lambda_permille  = 800;  /* Q(lambda) trace decay = 0.800 */
 static int alpha_permille   = 200;  /* learning rate = 0.200 */
 static int gamma_permille   = 900;  /* discount factor = 0.900 */
 static int epsilon_permille = 200;  /* exploration prob = 0.200 */
+static int epsilon_decay;           /* enum rl_epsilon_decay */
+static unsigned int epsilon_decay_k = 100; /* visits/ticks to halve epsilon */
+static int epsilon_min_permille;    /* floor of the decayed epsilon */
 static unsigned int interval_ms = 1000; /* sampling interval in ms */
+static unsigned int interval_us;        /* if set, overrides interval_ms */
+static bool adaptive_interval;            /* scale the tick period with load */
+static unsigned int interval_min_us = 10000;   /* adaptive lower bound */
+static unsigned int interval_max_us = 5000000; /* adaptive upper bound */
+static unsigned int adapt_pressure_permille = 100; /* "busy" pressure level */
+static unsigned int adapt_qdelta = 5;      /* mean |dQ| below this = converged */
+static bool percpu_workers;               /* one worker + shard per CPU */
+static bool debug;                        /* log actuations to dmesg */
+static bool dry_run;                      /* decide, but change nothing */
 static int action_step = 5;       /* change in nice per action (capped) */
+static unsigned int max_actions_per_tick; /* boost/penalize actions per worker tick, 0 = any */
+static unsigned int min_dwell_ms; /* per task, between two knob changes */
+static unsigned int hysteresis;   /* net same-way actions needed to act */
+static int actuator;              /* enum rl_actuator_id */
+static unsigned int weight_step_pct = 25; /* cpu.weight change per action */
+static unsigned int uclamp_step = 128;    /* uclamp change per action, of 1024 */
+static char *cgroup_root = "/sys/fs/cgroup"; /* cgroup v2 mount point */
+static int group_mode;            /* enum rl_group_mode */
+static bool group_task_agents;    /* per-task agents inside groups too */
+static bool skip_kthreads = true; /* never manage kernel threads */
+static bool skip_rt = true;       /* never manage RT/deadline tasks */
+static bool skip_idle = true;     /* no step for tasks that did not run */
+static unsigned int max_entries = 32768; /* cap on tracked pids */
+static unsigned int pool_size = 256;     /* preallocated pid_entry objects */
+static unsigned int scan_max_tasks;      /* tasks visited per tick, 0 = all */
+static unsigned int scan_budget_us;      /* scan time per tick, 0 = unbounded */
+static unsigned int scan_batch = 64;     /* tasks per RCU section */
+static int scope;                        /* enum rl_scope */
+static int policy_share;                 /* enum rl_share */
+static unsigned int max_policies = 4096; /* cap on shared Q-tables */
+static char *preload;                    /* Q-table dump loaded at init */
+
+/* reward weights (permille): r = (w_cpu*cpu_ms - w_wait*wait_ms - w_pr*pressure) / 1000 */
+static int reward_cpu_permille = 200;       /* credit for CPU progress */
+static int reward_wait_permille = 1000;     /* penalty for runqueue wait */
+static int reward_pressure_permille = 10;   /* penalty for system CPU pressure */
+
+/*
+ * State discretization. Each state component is bucketed by an ascending
+ * list of thresholds (n thresholds -> n + 1 buckets, none -> component
+ * ignored). Counts and times are per sampling interval.
+ */
+#define RL_MAX_THRESH 7
+#define RL_MAX_STATES 4096
+
+static unsigned int cpu_thresh_us[RL_MAX_THRESH] = { 1000, 50000 };
+static unsigned int nr_cpu_thresh = 2;
+static unsigned int wait_thresh_us[RL_MAX_THRESH] = { 1000, 10000 };
+static unsigned int nr_wait_thresh = 2;
+static unsigned int vcsw_thresh[RL_MAX_THRESH];
+static unsigned int nr_vcsw_thresh;
+static unsigned int ivcsw_thresh[RL_MAX_THRESH];
+static unsigned int nr_ivcsw_thresh;
+static unsigned int util_thresh[RL_MAX_THRESH];
+static unsigned int nr_util_thresh;
 
 module_param(alpha_permille, int, 0644);
 MODULE_PARM_DESC(alpha_permille, "Learning rate × 1000 (e.g. 200 = 0.2)");
@@ -52,23 +174,208 @@ MODULE_PARM_DESC(alpha_permille, "Learning rate × 1000 (e.g. 200 = 0.2)");
 module_param(gamma_permille, int, 0644);
 MODULE_PARM_DESC(gamma_permille, "Discount factor × 1000 (e.g. 900 = 0.9)");
 
+module_param(algo, int, 0444);
+MODULE_PARM_DESC(algo, "Update rule: 0=Q-learning, 1=SARSA, 2=Double Q-learning, 3=Watkins Q(lambda)");
+
+module_param(lambda_permille, int, 0644);
+MODULE_PARM_DESC(lambda_permille, "Eligibility trace decay ×1000 for algo=3 (e.g. 800 = 0.8)");
+
 module_param(epsilon_permille, int, 0644);
 MODULE_PARM_DESC(epsilon_permille, "Exploration prob ×1000 (e.g. 200 = 0.2)");
 
+module_param(epsilon_decay, int, 0644);
+MODULE_PARM_DESC(epsilon_decay, "Epsilon decay: 0=none, 1=per visit of the state, 2=per tick period since load");
+
+module_param(epsilon_decay_k, uint, 0644);
+MODULE_PARM_DESC(epsilon_decay_k, "Visits or tick periods after which epsilon is halved (epsilon * k / (k + n))");
+
+module_param(epsilon_min_permille, int, 0644);
+MODULE_PARM_DESC(epsilon_min_permille, "Lower bound of the decayed epsilon ×1000");
+
 module_param(interval_ms, uint, 0644);
 MODULE_PARM_DESC(interval_ms, "Sampling interval in milliseconds");
 
+module_param(interval_us, uint, 0644);
+MODULE_PARM_DESC(interval_us, "Sampling interval in microseconds, overrides interval_ms when set (min 100)");
+
+module_param(adaptive_interval, bool, 0644);
+MODULE_PARM_DESC(adaptive_interval, "Shrink the tick period under load or while learning, grow it when quiet");
+
+module_param(interval_min_us, uint, 0644);
+MODULE_PARM_DESC(interval_min_us, "Shortest adaptive tick period in microseconds");
+
+module_param(interval_max_us, uint, 0644);
+MODULE_PARM_DESC(interval_max_us, "Longest adaptive tick period in microseconds");
+
+module_param(adapt_pressure_permille, uint, 0644);
+MODULE_PARM_DESC(adapt_pressure_permille, "CPU pressure ×1000 (or per-CPU load in excess of 1.0, ×1000) above which the period shrinks");
+
+module_param(adapt_qdelta, uint, 0644);
+MODULE_PARM_DESC(adapt_qdelta, "Mean |Q change| per update below which the policy counts as converged");
+
+module_param(percpu_workers, bool, 0444);
+MODULE_PARM_DESC(percpu_workers, "Run one worker per online CPU, each owning the tasks on that CPU");
+
+module_param(debug, bool, 0644);
+MODULE_PARM_DESC(debug, "Also log every actuation with pr_info (use the trace events instead)");
+
+module_param(dry_run, bool, 0644);
+MODULE_PARM_DESC(dry_run, "Shadow mode: learn and choose actions, but only record the intended changes");
+
 module_param(action_step, int, 0644);
 MODULE_PARM_DESC(action_step, "Nice change step magnitude");
 
+module_param(max_actions_per_tick, uint, 0644);
+MODULE_PARM_DESC(max_actions_per_tick, "Boost or penalize actions each worker may let through per tick (0 = unlimited)");
+
+module_param(min_dwell_ms, uint, 0644);
+MODULE_PARM_DESC(min_dwell_ms, "Minimum time between two knob changes of a task, ms (0 = none)");
+
+module_param(hysteresis, uint, 0644);
+MODULE_PARM_DESC(hysteresis, "Act once this many more boost than penalize actions (or vice versa) were chosen; opposite actions cancel (0/1 = act on each)");
+
+module_param(actuator, int, 0444);
+MODULE_PARM_DESC(actuator, "What actions change: 0=nice, 1=cgroup cpu.weight, 2=policy NORMAL/BATCH/IDLE, 3=uclamp");
+
+module_param(weight_step_pct, uint, 0644);
+MODULE_PARM_DESC(weight_step_pct, "cpu.weight change per action, percent (actuator=1)");
+
+module_param(uclamp_step, uint, 0644);
+MODULE_PARM_DESC(uclamp_step, "uclamp change per action, out of 1024 (actuator=3)");
+
+module_param(cgroup_root, charp, 0444);
+MODULE_PARM_DESC(cgroup_root, "cgroup v2 mount point (actuator=1, group_mode=1)");
+
+module_param(group_mode, int, 0444);
+MODULE_PARM_DESC(group_mode, "One agent per group acting on the group's weight: 0=off, 1=cgroup v2 (cpu.weight), 2=autogroup (nice)");
+
+module_param(group_task_agents, bool, 0444);
+MODULE_PARM_DESC(group_task_agents, "With group_mode, keep per-task agents inside each group as well");
+
+/* bumped on every filter change; tracked entries are rechecked against it */
+static atomic_t filter_gen;
+static atomic_t seeded_filter_gen;
+
+static int filter_param_set(const char *val, const struct kernel_param *kp)
+{
+    int ret = param_set_bool(val, kp);
+
+    if (!ret)
+        atomic_inc(&filter_gen);
+    return ret;
+}
+
+static const struct kernel_param_ops filter_param_ops = {
+    .set = filter_param_set,
+    .get = param_get_bool,
+};
+
+module_param_cb(skip_kthreads, &filter_param_ops, &skip_kthreads, 0644);
+MODULE_PARM_DESC(skip_kthreads, "Do not manage kernel threads (default on)");
+
+module_param_cb(skip_rt, &filter_param_ops, &skip_rt, 0644);
+MODULE_PARM_DESC(skip_rt, "Do not manage SCHED_FIFO/RR/DEADLINE tasks (default on)");
+
+module_param(skip_idle, bool, 0644);
+MODULE_PARM_DESC(skip_idle, "Skip the learning step for tasks that have not run since the last visit (default on)");
+
+module_param(max_entries, uint, 0444);
+MODULE_PARM_DESC(max_entries, "Maximum number of tracked pids (pid table cap)");
+
+module_param(pool_size, uint, 0644);
+MODULE_PARM_DESC(pool_size, "Number of pid entries preallocated for the scan path");
+
+module_param(scan_max_tasks, uint, 0644);
+MODULE_PARM_DESC(scan_max_tasks, "Max tasks visited per tick, rest resumes next tick (0 = no limit)");
+
+module_param(scan_budget_us, uint, 0644);
+MODULE_PARM_DESC(scan_budget_us, "Max scan time per tick in microseconds (0 = no limit)");
+
+module_param(scan_batch, uint, 0644);
+MODULE_PARM_DESC(scan_batch, "Tasks visited per RCU read-side section before rescheduling");
+
+module_param(scope, int, 0444);
+MODULE_PARM_DESC(scope, "Agent granularity: 0 = thread-group leader, 1 = every thread, 2 = whole process (aggregate)");
+
+module_param(policy_share, int, 0444);
+MODULE_PARM_DESC(policy_share, "Share Q-tables between tasks: 0 = off, 1 = by comm, 2 = by cgroup id, 3 = by executable inode");
+
+module_param(max_policies, uint, 0444);
+MODULE_PARM_DESC(max_policies, "Maximum number of shared Q-tables");
+
+module_param(preload, charp, 0444);
+MODULE_PARM_DESC(preload, "Path of a Q-table dump (from debugfs rl_sched/qtables) to warm-start from");
+
+module_param(reward_cpu_permille, int, 0644);
+MODULE_PARM_DESC(reward_cpu_permille, "Reward weight ×1000 per ms of CPU progress (throughput)");
+
+module_param(reward_wait_permille, int, 0644);
+MODULE_PARM_DESC(reward_wait_permille, "Penalty weight ×1000 per ms of runqueue wait (latency)");
+
+module_param(reward_pressure_permille, int, 0644);
+MODULE_PARM_DESC(reward_pressure_permille, "Penalty weight ×1000 per permille of system CPU pressure (the same for every task; keep it small next to the per-task terms)");
+
+module_param_array(cpu_thresh_us, uint, &nr_cpu_thresh, 0444);
+MODULE_PARM_DESC(cpu_thresh_us, "CPU time per interval bucket thresholds in us (default 1000,50000)");
+
+module_param_array(wait_thresh_us, uint, &nr_wait_thresh, 0444);
+MODULE_PARM_DESC(wait_thresh_us, "Runqueue wait (run_delay) per interval bucket thresholds in us (default 1000,10000)");
+
+module_param_array(vcsw_thresh, uint, &nr_vcsw_thresh, 0444);
+MODULE_PARM_DESC(vcsw_thresh, "Voluntary context switches per interval bucket thresholds (default none)");
+
+module_param_array(ivcsw_thresh, uint, &nr_ivcsw_thresh, 0444);
+MODULE_PARM_DESC(ivcsw_thresh, "Involuntary context switches per interval bucket thresholds (default none)");
+
+module_param_array(util_thresh, uint, &nr_util_thresh, 0444);
+MODULE_PARM_DESC(util_thresh, "PELT util_avg (0..1024) bucket thresholds (default none)");
+
+/* shortest supported sampling interval */
+#define RL_MIN_INTERVAL_US 100
+
 /* RL definitions */
-#define NUM_STATES 3   /* Low / Med / High CPU delta */
 #define NUM_ACTIONS 3  /* decrease nice (boost), increase nice (penalize), no-op */
+#define QIDX(s, a) ((s) * NUM_ACTIONS + (a))
+
+/* state components, most significant first in the state index */
+enum rl_dim {
+    RL_DIM_CPU = 0, /* CPU time consumed (ns) */
+    RL_DIM_WAIT,    /* time runnable but waiting on a runqueue (ns) */
+    RL_DIM_VCSW,    /* voluntary context switches */
+    RL_DIM_IVCSW,   /* involuntary context switches (preemptions) */
+    RL_DIM_UTIL,    /* PELT utilization, 0..1024 */
+    RL_NR_DIMS,
+};
+
+static const struct rl_state_dim {
+    const char *name;
+    unsigned int *thresh;
+    unsigned int *nr;
+    unsigned int unit; /* observation units per threshold unit */
+} rl_dims[RL_NR_DIMS] = {
+    [RL_DIM_CPU]   = { "cpu",   cpu_thresh_us,  &nr_cpu_thresh,   NSEC_PER_USEC },
+    [RL_DIM_WAIT]  = { "wait",  wait_thresh_us, &nr_wait_thresh,  NSEC_PER_USEC },
+    [RL_DIM_VCSW]  = { "vcsw",  vcsw_thresh,    &nr_vcsw_thresh,  1 },
+    [RL_DIM_IVCSW] = { "ivcsw", ivcsw_thresh,   &nr_ivcsw_thresh, 1 },
+    [RL_DIM_UTIL]  = { "util",  util_thresh,    &nr_util_thresh,  1 },
+};
+
+/* product of the bucket counts of all components, set at init */
+static unsigned int num_states;
+
+/* cumulative counters sampled from a task (util is instantaneous) */
+struct rl_sample {
+    u64 runtime;   /* se.sum_exec_runtime (ns) */
+    u64 run_delay; /* sched_info.run_delay (ns) */
+    u64 nvcsw;
+    u64 nivcsw;
+    u64 util;      /* se.avg.util_avg */
+    unsigned int nr_queued; /* threads on a runqueue right now */
+};
 
-enum rl_state {
-    RL_STATE_LOW = 0,
-    RL_STATE_MED = 1,
-    RL_STATE_HIGH = 2,
+/* one interval's observation, indexed by enum rl_dim */
+struct rl_obs {
+    u64 v[RL_NR_DIMS];
 };
 
 enum rl_action {
@@ -77,239 +384,4231 @@ enum rl_action {
     RL_NOOP     = 2,
 };
 
-/* Per-pid record */
+/* what a group agent stands for */
+enum rl_group_mode {
+    RL_GROUP_NONE      = 0, /* per-task agents only */
+    RL_GROUP_CGROUP    = 1, /* cgroup v2 group, acts on cpu.weight */
+    RL_GROUP_AUTOGROUP = 2, /* session autogroup, acts on its nice */
+};
+
+/* update rules, see q_update() */
+enum rl_algo {
+    RL_ALGO_Q        = 0, /* one-step Q-learning, max over the next state */
+    RL_ALGO_SARSA    = 1, /* on-policy: the action actually chosen next */
+    RL_ALGO_DOUBLE_Q = 2, /* two tables, one picks and the other rates */
+    RL_ALGO_Q_LAMBDA = 3, /* Watkins's Q(lambda), eligibility traces */
+    RL_NR_ALGOS,
+};
+
+/*
+ * Q(lambda) keeps each agent's last RL_TRACE_LEN state-action pairs as
+ * its eligibility trace; older pairs have decayed by (gamma * lambda)^8
+ * and are dropped.
+ */
+#define RL_TRACE_LEN 8
+
+/* epsilon_decay schedules */
+enum rl_epsilon_decay {
+    RL_DECAY_NONE   = 0, /* epsilon_permille throughout */
+    RL_DECAY_VISITS = 1, /* by how often the agent has seen the state */
+    RL_DECAY_TICKS  = 2, /* by tick periods since the module was loaded */
+};
+
+/*
+ * Run mode, set through /sys/kernel/rl_sched/mode. exploit freezes the
+ * Q-tables and always takes the best known action; pause stops both
+ * learning and actuation, and tasks are not even sampled. Knobs keep the
+ * value they had, so the next step after resuming credits the time
+ * paused to the action still in effect.
+ */
+enum rl_mode {
+    RL_MODE_LEARN,
+    RL_MODE_EXPLOIT,
+    RL_MODE_PAUSE,
+    RL_NR_MODES,
+};
+
+static const char * const rl_mode_names[RL_NR_MODES] = {
+    [RL_MODE_LEARN]   = "learn",
+    [RL_MODE_EXPLOIT] = "exploit",
+    [RL_MODE_PAUSE]   = "pause",
+};
+
+static int rl_mode;      /* enum rl_mode */
+static u64 rl_start_ns;  /* ktime at load, for RL_DECAY_TICKS */
+
+/* knob the actions move; see rl_actuators[] */
+enum rl_actuator_id {
+    RL_ACT_NICE   = 0, /* nice +- action_step */
+    RL_ACT_WEIGHT = 1, /* cgroup v2 cpu.weight */
+    RL_ACT_POLICY = 2, /* SCHED_IDLE < SCHED_BATCH < SCHED_NORMAL */
+    RL_ACT_UCLAMP = 3, /* util clamp */
+    RL_NR_ACTUATORS,
+};
+
+static const char * const rl_action_names[NUM_ACTIONS] = {
+    [RL_DEC_NICE] = "dec_nice",
+    [RL_INC_NICE] = "inc_nice",
+    [RL_NOOP]     = "noop",
+};
+
+/* what one agent observes and acts on */
+enum rl_scope {
+    RL_SCOPE_LEADER  = 0, /* leader's own runtime, renice the leader only */
+    RL_SCOPE_THREAD  = 1, /* one agent per thread */
+    RL_SCOPE_PROCESS = 2, /* group runtime summed, renice every thread */
+};
+
+/* how tasks are grouped onto a shared Q-table */
+enum rl_share {
+    RL_SHARE_NONE   = 0, /* every task learns on its own table */
+    RL_SHARE_COMM   = 1, /* task->comm */
+    RL_SHARE_CGROUP = 2, /* cgroup v2 id */
+    RL_SHARE_EXE    = 3, /* executable inode + device */
+};
+
+struct rl_policy_key {
+    union {
+        char comm[TASK_COMM_LEN];
+        struct {
+            u64 id;  /* cgroup id or inode number */
+            u64 dev; /* device of the executable */
+        };
+    };
+};
+
+#define RL_POLICY_NAME_LEN 128
+
+/*
+ * Q-table shared by all tasks with the same key. Updates from different
+ * tasks are merged with atomic adds. Policies are never freed before
+ * unload, so what was learned outlives the tasks that learned it.
+ * Without policy_share the table holds templates keyed by comm, loaded
+ * from a dump, that new agents start from.
+ */
+struct rl_policy {
+    struct rl_policy_key key;
+    struct rhash_head node;
+    char comm[TASK_COMM_LEN]; /* first task seen, for reporting */
+    char name[RL_POLICY_NAME_LEN]; /* key as saved in dumps: comm or cgroup path */
+    u32 load_gen;             /* last qdump_load() that wrote it */
+    atomic_t qtable[];        /* q_tables x num_states x NUM_ACTIONS, permille */
+};
+
+/*
+ * Per-pid record: only what lookup and lifetime management need. The
+ * learning state lives in the dense arrays of rl_store at index idx.
+ */
 struct pid_entry {
     pid_t pid;
-    unsigned long long prev_runtime; /* previous se.sum_exec_runtime snapshot (ns) */
-    long qtable[NUM_STATES][NUM_ACTIONS]; /* Q-values scaled as permille */
-    enum rl_state prev_state;
-    int prev_action;
-    struct list_head list;
+    u32 idx;                         /* slot in rl_store */
+    struct rl_policy *policy;        /* shared Q-table, NULL = private row */
+    bool dead;                       /* out of pid_table, owner frees it */
+    int handoff_cpu;                 /* shard it is being moved to */
+    u32 filter_gen;                  /* filter_gen it was last checked at */
+    bool has_orig;                   /* orig_val is set (release/acquire) */
+    long orig_val;                   /* knob value before our first change */
+    s8 pending;                      /* hysteresis: net boosts - penalties */
+    u64 last_change_ns;              /* ktime of the last knob change */
+    struct rhash_head node;
+    struct list_head shard_node;     /* on the owning shard's list */
+    struct llist_node handoff;       /* in a shard's inbox */
+    union {
+        struct rcu_head rcu;         /* deferred free after removal */
+        struct llist_node pool_node; /* link while parked in the pool */
+    };
+};
+
+/*
+ * Structure-of-arrays learning state, indexed by pid_entry->idx. Indices
+ * are handed out lowest-first so live agents stay packed at the front of
+ * each array, and an agent's private Q-table is one contiguous row of
+ * num_states x NUM_ACTIONS 32-bit permille values (two such tables back
+ * to back for Double Q-learning, see q_tables). An index is released
+ * only after the RCU grace period that frees its entry, so an update
+ * running under rcu_read_lock, or by the entry's owning worker, never
+ * lands in a recycled row.
+ */
+static struct {
+    spinlock_t lock;            /* protects used */
+    unsigned long *used;        /* allocated indices */
+    s32 *q;                     /* [idx][state][action] */
+    u64 *prev_runtime;          /* counters at the previous visit */
+    u64 *prev_run_delay;
+    u64 *prev_stamp;            /* ktime (ns) of the previous visit */
+    u32 *prev_nvcsw;
+    u32 *prev_nivcsw;
+    u16 *prev_state;
+    u8 *prev_action;
+    u32 *visits;                /* [idx][state] */
+    u32 *trace;                 /* Q(lambda): [idx][RL_TRACE_LEN] s << 8 | a */
+    u8 *trace_len;
+} rl_store;
+
+/*
+ * One scan batch, worked in three phases: the snapshot copies each task's
+ * counters under RCU, the compute phase turns them into Q-updates and
+ * actions without touching any task, and the actuation phase applies the
+ * actions grouped by CPU so each runqueue lock is taken back to back.
+ * Allocated per worker, next to its CPU.
+ */
+#define RL_MAX_BATCH 256
+
+/* no action to apply for a snapshot, or restore the knob to restore_val */
+#define RL_NO_ACTION 0xff
+#define RL_RESTORE   0xfe
+
+struct rl_snap {
+    struct pid_entry *pe;
+    struct task_struct *task;   /* referenced */
+    struct rl_sample smp;
+    u64 stamp;                  /* ktime (ns) of the sample */
+    int cpu;                    /* task's CPU at the snapshot */
+    u64 cgrp;                   /* weight actuator: the task's cgroup id */
+    u8 action;                  /* chosen action, RL_NO_ACTION or RL_RESTORE */
+    long restore_val;           /* RL_RESTORE: the entry may be gone */
+};
+
+struct rl_batch {
+    unsigned int n;
+    struct rl_snap snap[RL_MAX_BATCH];
+    u64 qdelta;                 /* summed |Q-change| of the batch */
+    unsigned int q_updates;
+};
+
+enum rl_phase {
+    RL_PHASE_SNAPSHOT,
+    RL_PHASE_COMPUTE,
+    RL_PHASE_ACTUATE,
+    RL_NR_PHASES,
+};
+
+static const char * const rl_phase_names[RL_NR_PHASES] = {
+    [RL_PHASE_SNAPSHOT] = "snapshot",
+    [RL_PHASE_COMPUTE]  = "compute",
+    [RL_PHASE_ACTUATE]  = "actuate",
+};
+
+/* why a chosen action was not applied */
+enum rl_suppress {
+    RL_SUPPRESS_HYSTERESIS,
+    RL_SUPPRESS_DWELL,
+    RL_SUPPRESS_BUDGET,
+    RL_SUPPRESS_CGROUP,         /* cgroup's weight already moved this tick */
+    RL_NR_SUPPRESS,
+};
+
+static const char * const rl_suppress_names[RL_NR_SUPPRESS] = {
+    [RL_SUPPRESS_HYSTERESIS] = "hysteresis",
+    [RL_SUPPRESS_DWELL]      = "dwell",
+    [RL_SUPPRESS_BUDGET]     = "budget",
+    [RL_SUPPRESS_CGROUP]     = "cgroup",
+};
+
+/* tick durations are binned by log2 of microseconds: <1, 1, 2-3, 4-7, ... */
+#define RL_TICK_HIST 16
+
+/* counters of one worker, written by it only and summed by readers */
+struct rl_stats {
+    unsigned long ticks;
+    unsigned long scanned;
+    unsigned long skipped_idle;
+    unsigned long actions[NUM_ACTIONS];
+    unsigned long knob_changes;  /* made, or with dry_run intended */
+    unsigned long suppressed[RL_NR_SUPPRESS];
+    unsigned long tick_hist[RL_TICK_HIST];
+    u64 phase_ns[RL_NR_PHASES];  /* time spent in each batch phase */
+};
+
+/*
+ * A shard of the tracked set, owned by one worker thread: the global one,
+ * or with percpu_workers one per online CPU holding the tasks last seen
+ * on that CPU. Only the owner touches the entries list. Other contexts
+ * hand entries over through the lock-free inbox, and only mark entries
+ * dead instead of unlinking them. The list is scanned from the head and
+ * visited entries rotate to the tail, so the head is where a bounded scan
+ * resumes on the next tick.
+ */
+struct rl_shard {
+    struct task_struct *thread;
+    int cpu;                    /* -1 for the global worker */
+    bool online;                /* has a worker, accepts handoffs */
+    struct list_head entries;
+    unsigned int nr;            /* entries on the list */
+    unsigned int pass_left;     /* entries still to visit in this pass */
+    struct llist_head inbox;    /* new or migrating entries */
+    struct rl_batch *batch;     /* allocated while the worker runs */
+    unsigned int tick_changes;  /* actions let through in the current tick */
+    u64 pass_wait_ns;           /* per-interval wait summed over this pass */
+    u64 last_pass_wait_ns;      /* same, for the last complete pass */
+    struct rl_stats stats;
+};
+
+static struct rl_shard rl_global_shard;
+static struct rl_shard __percpu *rl_shards;
+static int rl_cpuhp_state;
+
+/*
+ * Global pid table. Lookups are RCU-protected, inserts/removals use the
+ * per-bucket locks of the rhashtable, and the table grows/shrinks with the
+ * number of tracked pids up to max_entries.
+ */
+static struct rhashtable pid_table;
+
+static const struct rhashtable_params pid_table_params = {
+    .key_len             = sizeof(pid_t),
+    .key_offset          = offsetof(struct pid_entry, pid),
+    .head_offset         = offsetof(struct pid_entry, node),
+    .automatic_shrinking = true,
+};
+
+static struct rhashtable policy_table;
+
+static const struct rhashtable_params policy_table_params = {
+    .key_len     = sizeof(struct rl_policy_key),
+    .key_offset  = offsetof(struct rl_policy, key),
+    .head_offset = offsetof(struct rl_policy, node),
 };
 
-/* Global list and lock */
-static LIST_HEAD(pid_table);
-static spinlock_t pid_table_lock;
+/*
+ * Entry allocation. Objects come from a dedicated slab cache, but the scan
+ * path (which runs under rcu_read_lock) only ever takes them from a
+ * preallocated pool. The pool is topped up to pool_size with GFP_KERNEL
+ * allocations outside any atomic section.
+ */
+static struct kmem_cache *pid_entry_cache;
+
+static struct {
+    spinlock_t lock;
+    struct llist_head free;
+    unsigned int nr;
+} entry_pool;
+
+static atomic_long_t pool_misses; /* pool was empty when an entry was needed */
 
-/* RL worker thread */
-static struct task_struct *rl_thread;
+/*
+ * Set when a new task could not be tracked (pool and atomic allocation both
+ * failed); the worker then re-seeds the table from the task list.
+ */
+static atomic_t resync_needed;
+
+/*
+ * System CPU pressure in permille: PSI "some avg10" of /proc/pressure/cpu,
+ * read once per tick period. Without PSI it is estimated from the
+ * run_delay seen over the last full pass instead: average number of
+ * waiting tracked tasks per online CPU, capped at 1000.
+ */
+static unsigned int sys_pressure;
+static bool psi_unavailable;
+static atomic64_t psi_next_ns;
+
+/* ticks whose deadline had already passed when the previous tick ended */
+static atomic_long_t missed_deadlines;
 
-/* Utility: categorize cpu delta (ns) into state buckets */
-static enum rl_state cpu_delta_to_state(unsigned long long delta_ns)
+/*
+ * Configured sampling period in ns. Observations are always normalized to
+ * this period, even when adaptive_interval ticks faster or slower.
+ */
+static u64 rl_interval_ns(void)
 {
-    if (delta_ns < 1000000ULL)       /* < 1ms */
-        return RL_STATE_LOW;
-    if (delta_ns < 50000000ULL)      /* < 50ms */
-        return RL_STATE_MED;
-    return RL_STATE_HIGH;
+    unsigned int us = READ_ONCE(interval_us);
+
+    if (us)
+        return (u64)max_t(unsigned int, us, RL_MIN_INTERVAL_US) * NSEC_PER_USEC;
+    return (u64)max_t(unsigned int, READ_ONCE(interval_ms), 1) * NSEC_PER_MSEC;
 }
 
-/* Find or create pid_entry for pid */
-static struct pid_entry *get_pid_entry(pid_t pid)
-{
-    struct pid_entry *e;
+/* period actually used between ticks (adaptive mode moves it) */
+static u64 effective_interval_ns;
 
-    list_for_each_entry(e, &pid_table, list) {
-        if (e->pid == pid)
-            return e;
-    }
+/* |Q change| summed over updates since the last adaptation step */
+static atomic64_t tick_qdelta_sum;
+static atomic_t tick_q_updates;
+static atomic64_t next_adapt_ns; /* one worker adapts per period */
 
-    e = kzalloc(sizeof(*e), GFP_KERNEL);
-    if (!e)
-        return NULL;
-    e->pid = pid;
-    e->prev_runtime = 0;
-    e->prev_state = RL_STATE_LOW;
-    e->prev_action = RL_NOOP;
-    memset(e->qtable, 0, sizeof(e->qtable));
-    list_add(&e->list, &pid_table);
-    return e;
-}
+/* actuator calls that failed (e.g. cpu.weight not writable) */
+static atomic_long_t actuate_errors;
 
-static void remove_pid_entry(pid_t pid)
+/* sysfs directory /sys/kernel/rl_sched */
+static struct kobject *rl_kobj;
+
+/* bucket index of value v within one state component */
+static unsigned int dim_bucket(const struct rl_state_dim *d, u64 v)
 {
-    struct pid_entry *e, *tmp;
-    list_for_each_entry_safe(e, tmp, &pid_table, list) {
-        if (e->pid == pid) {
-            list_del(&e->list);
-            kfree(e);
-            return;
-        }
+    unsigned int i;
+
+    for (i = 0; i < *d->nr; i++) {
+        if (v < (u64)d->thresh[i] * d->unit)
+            break;
     }
+    return i;
 }
 
-/* clamp nice between -20 and 19 */
-static int clamp_nice(int nice)
+/* Utility: map an observation to a state index (mixed radix over components) */
+static int obs_to_state(const struct rl_obs *obs)
 {
-    if (nice < -20) return -20;
-    if (nice > 19) return 19;
-    return nice;
+    unsigned int st = 0;
+    int i;
+
+    for (i = 0; i < RL_NR_DIMS; i++)
+        st = st * (*rl_dims[i].nr + 1) + dim_bucket(&rl_dims[i], obs->v[i]);
+    return st;
 }
 
-/* choose action with epsilon-greedy on qtable row */
-static int choose_action(struct pid_entry *pe, enum rl_state st)
+/* validate the thresholds and compute num_states */
+static int init_state_space(void)
 {
-    u32 r = get_random_u32() % 1000; /* 0..999 */
-    if (r < epsilon_permille) {
-        return get_random_u32() % NUM_ACTIONS;
-    } else {
-        long best = LONG_MIN;
-        int best_a = 0, a;
-        for (a = 0; a < NUM_ACTIONS; a++) {
-            long val = pe->qtable[st][a];
-            if (val > best) {
-                best = val;
-                best_a = a;
+    unsigned int i, j, n = 1;
+
+    for (i = 0; i < RL_NR_DIMS; i++) {
+        const struct rl_state_dim *d = &rl_dims[i];
+
+        for (j = 1; j < *d->nr; j++) {
+            if (d->thresh[j] <= d->thresh[j - 1]) {
+                pr_err("rl_sched_mod: %s thresholds must be ascending\n",
+                       d->name);
+                return -EINVAL;
             }
         }
-        return best_a;
+        n *= *d->nr + 1;
+        if (n > RL_MAX_STATES) {
+            pr_err("rl_sched_mod: state space exceeds %d states\n",
+                   RL_MAX_STATES);
+            return -EINVAL;
+        }
     }
+    num_states = n;
+    return 0;
 }
 
-/* Q-learning update (all values in permille scaling) */
-static void q_update(struct pid_entry *pe, enum rl_state s, int a,
-                     long reward, enum rl_state s_next)
+/* Q-tables per agent: 2 for Double Q-learning, else 1 */
+static unsigned int q_tables = 1;
+
+static s32 *q_row(u32 idx)
 {
-    long q = pe->qtable[s][a];
-    long best_next = LONG_MIN;
-    int i;
+    return &rl_store.q[(size_t)idx * q_tables * num_states * NUM_ACTIONS];
+}
 
-    for (i = 0; i < NUM_ACTIONS; i++) {
-        if (pe->qtable[s_next][i] > best_next)
-            best_next = pe->qtable[s_next][i];
-    }
-    if (best_next == LONG_MIN)
-        best_next = 0;
+/* claim the lowest free store slot and reset it; never sleeps */
+static int store_alloc_idx(u32 *idx)
+{
+    unsigned long flags, bit;
 
-    /* Q’ = Q + α * (reward + γ*best_next − Q) / 1000 */
-    long tmp = reward + (gamma_permille * best_next) / 1000 - q;
-    q = q + (alpha_permille * tmp) / 1000;
+    spin_lock_irqsave(&rl_store.lock, flags);
+    bit = find_first_zero_bit(rl_store.used, max_entries);
+    if (bit < max_entries)
+        __set_bit(bit, rl_store.used);
+    spin_unlock_irqrestore(&rl_store.lock, flags);
+    if (bit >= max_entries)
+        return -ENOSPC;
 
-    pe->qtable[s][a] = q;
+    memset(q_row(bit), 0, q_tables * num_states * NUM_ACTIONS * sizeof(s32));
+    rl_store.prev_runtime[bit] = 0;
+    rl_store.prev_run_delay[bit] = 0;
+    rl_store.prev_stamp[bit] = 0;
+    rl_store.prev_nvcsw[bit] = 0;
+    rl_store.prev_nivcsw[bit] = 0;
+    rl_store.prev_state[bit] = 0;
+    rl_store.prev_action[bit] = RL_NOOP;
+    memset(&rl_store.visits[(size_t)bit * num_states], 0, num_states * sizeof(u32));
+    if (rl_store.trace_len)
+        rl_store.trace_len[bit] = 0;
+    *idx = bit;
+    return 0;
 }
 
-/* apply action to task: adjust nice by step */
-static void apply_action_to_task(struct task_struct *task, int action)
+/* may run from an RCU callback */
+static void store_free_idx(u32 idx)
 {
-    int new_nice, cur_nice;
+    unsigned long flags;
 
-    cur_nice = task_nice(task);
-    switch (action) {
-    case RL_DEC_NICE:
-        new_nice = cur_nice - action_step;
-        break;
-    case RL_INC_NICE:
-        new_nice = cur_nice + action_step;
-        break;
-    case RL_NOOP:
-    default:
-        new_nice = cur_nice;
-        break;
+    spin_lock_irqsave(&rl_store.lock, flags);
+    __clear_bit(idx, rl_store.used);
+    spin_unlock_irqrestore(&rl_store.lock, flags);
+}
+
+static void store_free(void)
+{
+    bitmap_free(rl_store.used);
+    kvfree(rl_store.q);
+    kvfree(rl_store.prev_runtime);
+    kvfree(rl_store.prev_run_delay);
+    kvfree(rl_store.prev_stamp);
+    kvfree(rl_store.prev_nvcsw);
+    kvfree(rl_store.prev_nivcsw);
+    kvfree(rl_store.prev_state);
+    kvfree(rl_store.prev_action);
+    kvfree(rl_store.visits);
+    kvfree(rl_store.trace);
+    kvfree(rl_store.trace_len);
+}
+
+static int store_init(void)
+{
+    size_t n = max_entries;
+
+    spin_lock_init(&rl_store.lock);
+    rl_store.used = bitmap_zalloc(n, GFP_KERNEL);
+    rl_store.q = kvcalloc(n * q_tables * num_states * NUM_ACTIONS, sizeof(s32),
+                          GFP_KERNEL);
+    rl_store.prev_runtime = kvcalloc(n, sizeof(u64), GFP_KERNEL);
+    rl_store.prev_run_delay = kvcalloc(n, sizeof(u64), GFP_KERNEL);
+    rl_store.prev_stamp = kvcalloc(n, sizeof(u64), GFP_KERNEL);
+    rl_store.prev_nvcsw = kvcalloc(n, sizeof(u32), GFP_KERNEL);
+    rl_store.prev_nivcsw = kvcalloc(n, sizeof(u32), GFP_KERNEL);
+    rl_store.prev_state = kvcalloc(n, sizeof(u16), GFP_KERNEL);
+    rl_store.prev_action = kvcalloc(n, sizeof(u8), GFP_KERNEL);
+    rl_store.visits = kvcalloc(n * num_states, sizeof(u32), GFP_KERNEL);
+    if (algo == RL_ALGO_Q_LAMBDA) {
+        rl_store.trace = kvcalloc(n * RL_TRACE_LEN, sizeof(u32), GFP_KERNEL);
+        rl_store.trace_len = kvcalloc(n, sizeof(u8), GFP_KERNEL);
     }
-    new_nice = clamp_nice(new_nice);
-    if (new_nice != cur_nice) {
-        pr_info("rl_sched_mod: PID %d (%s) action=%d nice: %d -> %d\n",
-        task->pid, task->comm, action, cur_nice, new_nice);
-        set_user_nice(task, new_nice);
+
+    if (!rl_store.used || !rl_store.q || !rl_store.prev_runtime ||
+        !rl_store.prev_run_delay || !rl_store.prev_stamp ||
+        !rl_store.prev_nvcsw || !rl_store.prev_nivcsw ||
+        !rl_store.prev_state || !rl_store.prev_action || !rl_store.visits ||
+        (algo == RL_ALGO_Q_LAMBDA && (!rl_store.trace || !rl_store.trace_len))) {
+        store_free();
+        return -ENOMEM;
     }
+    return 0;
 }
 
-/* main RL worker */
-static int rl_worker(void *arg)
+/* take a zeroed entry from the pool; never sleeps */
+static struct pid_entry *pool_get_entry(void)
 {
-    while (!kthread_should_stop()) {
-        rcu_read_lock();
-        {
-            struct task_struct *p;
-            for_each_process(p) {
-                unsigned long long curr_runtime = 0;
-                unsigned long long delta = 0;
-                enum rl_state st;
-                struct pid_entry *pe;
+    struct llist_node *n;
 
-                if (p->exit_state == EXIT_ZOMBIE || p->exit_state == EXIT_DEAD)
-                    continue;
+    spin_lock(&entry_pool.lock);
+    n = llist_del_first(&entry_pool.free);
+    if (n)
+        entry_pool.nr--;
+    spin_unlock(&entry_pool.lock);
 
-                curr_runtime = (unsigned long long)p->se.sum_exec_runtime;
+    if (!n) {
+        atomic_long_inc(&pool_misses);
+        return NULL;
+    }
+    return llist_entry(n, struct pid_entry, pool_node);
+}
 
-                spin_lock(&pid_table_lock);
-                pe = get_pid_entry(p->pid);
-                spin_unlock(&pid_table_lock);
-                if (!pe)
-                    continue;
+/* return an unused (never published) entry to the pool */
+static void pool_put_entry(struct pid_entry *e)
+{
+    memset(e, 0, sizeof(*e));
+    spin_lock(&entry_pool.lock);
+    llist_add(&e->pool_node, &entry_pool.free);
+    entry_pool.nr++;
+    spin_unlock(&entry_pool.lock);
+}
 
-                if (pe->prev_runtime == 0) {
-                    pe->prev_runtime = curr_runtime;
-                    continue;
-                }
+/* top the pool up to pool_size; may sleep, call outside RCU */
+static void pool_refill(void)
+{
+    struct pid_entry *e;
+
+    while (READ_ONCE(entry_pool.nr) < READ_ONCE(pool_size)) {
+        e = kmem_cache_zalloc(pid_entry_cache, GFP_KERNEL);
+        if (!e)
+            break;
+        spin_lock(&entry_pool.lock);
+        llist_add(&e->pool_node, &entry_pool.free);
+        entry_pool.nr++;
+        spin_unlock(&entry_pool.lock);
+    }
+}
 
-                delta = (curr_runtime >= pe->prev_runtime) ?
-                        (curr_runtime - pe->prev_runtime) : 0;
-                st = cpu_delta_to_state(delta);
+static void pool_drain(void)
+{
+    struct llist_node *n, *next;
 
-                {
-                    int action = choose_action(pe, st);
-                    apply_action_to_task(p, action);
+    spin_lock(&entry_pool.lock);
+    n = llist_del_all(&entry_pool.free);
+    entry_pool.nr = 0;
+    spin_unlock(&entry_pool.lock);
 
-                    /* reward = -(delta / 1000) → negative ms used */
-                    long reward = -(long)(delta / 1000000ULL);
+    llist_for_each_safe(n, next, n)
+        kmem_cache_free(pid_entry_cache,
+                        llist_entry(n, struct pid_entry, pool_node));
+}
 
-                    if (pe->prev_action >= 0 && pe->prev_action < NUM_ACTIONS) {
-                        q_update(pe, pe->prev_state, pe->prev_action, reward, st);
-                    }
+static void pid_entry_free_rcu(struct rcu_head *head)
+{
+    struct pid_entry *e = container_of(head, struct pid_entry, rcu);
 
-                    pe->prev_state = st;
-                    pe->prev_action = action;
-                }
+    store_free_idx(e->idx);
+    kmem_cache_free(pid_entry_cache, e);
+}
 
-                pe->prev_runtime = curr_runtime;
-            }
-        }
+/* build the sharing key for p; false if p has none (e.g. no mm) */
+static bool policy_key(struct task_struct *p, struct rl_policy_key *key)
+{
+    bool ok = false;
+
+    memset(key, 0, sizeof(*key));
+    switch (policy_share) {
+    case RL_SHARE_COMM:
+        strscpy_pad(key->comm, p->comm, sizeof(key->comm));
+        ok = true;
+        break;
+    case RL_SHARE_CGROUP:
+#ifdef CONFIG_CGROUPS
+        rcu_read_lock();
+        key->id = cgroup_id(task_dfl_cgroup(p));
         rcu_read_unlock();
+        ok = true;
+#endif
+        break;
+    case RL_SHARE_EXE:
+        task_lock(p);
+        if (p->mm) {
+            struct file *exe;
 
-        msleep_interruptible(interval_ms);
+            rcu_read_lock();
+            exe = rcu_dereference(p->mm->exe_file);
+            if (exe) {
+                key->id = file_inode(exe)->i_ino;
+                key->dev = file_inode(exe)->i_sb->s_dev;
+                ok = true;
+            }
+            rcu_read_unlock();
+        }
+        task_unlock(p);
+        break;
     }
-    return 0;
+    return ok;
 }
 
-/* helper to cleanup list */
-static void free_all_entries(void)
+static struct rl_policy *policy_alloc(const struct rl_policy_key *key, gfp_t gfp)
 {
-    struct pid_entry *e, *tmp;
-    spin_lock(&pid_table_lock);
-    list_for_each_entry_safe(e, tmp, &pid_table, list) {
-        list_del(&e->list);
-        kfree(e);
+    struct rl_policy *pol;
+
+    if (atomic_read(&policy_table.nelems) >= max_policies)
+        return NULL;
+    pol = kzalloc(struct_size(pol, qtable, q_tables * num_states * NUM_ACTIONS), gfp);
+    if (pol)
+        pol->key = *key;
+    return pol;
+}
+
+/* publish a new policy, or return the one that won the race for its key */
+static struct rl_policy *policy_insert(struct rl_policy *pol)
+{
+    struct rl_policy *old;
+
+    old = rhashtable_lookup_get_insert_fast(&policy_table, &pol->node,
+                                            policy_table_params);
+    if (old) {
+        kfree(pol);
+        return IS_ERR(old) ? NULL : old;
     }
-    spin_unlock(&pid_table_lock);
+    return pol;
 }
 
-/* module init/exit */
-static int __init rl_init(void)
+/* find or create the shared Q-table for p; never sleeps */
+static struct rl_policy *policy_for_task(struct task_struct *p)
 {
-    pr_info("rl_sched_mod: init (alpha=%d gamma=%d epsilon=%d interval_ms=%u action_step=%d)\n",
-            alpha_permille, gamma_permille, epsilon_permille, interval_ms, action_step);
-    spin_lock_init(&pid_table_lock);
+    struct rl_policy_key key;
+    struct rl_policy *pol;
+
+    if (policy_share == RL_SHARE_NONE || !policy_key(p, &key))
+        return NULL;
 
-    rl_thread = kthread_run(rl_worker, NULL, "rl_sched_thread");
-    if (IS_ERR(rl_thread)) {
-        pr_err("rl_sched_mod: failed to create worker thread\n");
-        rl_thread = NULL;
-        return PTR_ERR(rl_thread);
+    pol = rhashtable_lookup_fast(&policy_table, &key, policy_table_params);
+    if (pol)
+        return pol;
+
+    pol = policy_alloc(&key, GFP_NOWAIT | __GFP_NOWARN);
+    if (!pol)
+        return NULL;
+    strscpy(pol->comm, p->comm, sizeof(pol->comm));
+    strscpy(pol->name, p->comm, sizeof(pol->name));
+#ifdef CONFIG_CGROUPS
+    if (policy_share == RL_SHARE_CGROUP) {
+        rcu_read_lock();
+        cgroup_path(task_dfl_cgroup(p), pol->name, sizeof(pol->name));
+        rcu_read_unlock();
     }
-    return 0;
+#endif
+    return policy_insert(pol);
 }
 
-static void __exit rl_exit(void)
+/* without policy_share, start a new agent from the template of its comm */
+static void template_apply(struct task_struct *p, u32 idx)
 {
-    pr_info("rl_sched_mod: exit\n");
-    if (rl_thread)
-        kthread_stop(rl_thread);
+    struct rl_policy_key key = {};
+    struct rl_policy *tpl;
+    s32 *row = q_row(idx);
+    unsigned int i;
 
-    free_all_entries();
-    pr_info("rl_sched_mod: cleaned up\n");
+    if (policy_share != RL_SHARE_NONE || !atomic_read(&policy_table.nelems))
+        return;
+    strscpy_pad(key.comm, p->comm, sizeof(key.comm));
+    tpl = rhashtable_lookup_fast(&policy_table, &key, policy_table_params);
+    if (!tpl)
+        return;
+    for (i = 0; i < q_tables * num_states * NUM_ACTIONS; i++)
+        row[i] = atomic_read(&tpl->qtable[i]);
 }
 
-module_init(rl_init);
-module_exit(rl_exit);
+/*
+ * Q-table accessors: shared tables are merged atomically. Entry i of table
+ * t sits at t * num_states * NUM_ACTIONS + i. The value of an entry, as
+ * acted on, shown and dumped, is the mean over the tables.
+ */
+static s32 q_row_val(const s32 *row, unsigned int i)
+{
+    if (q_tables == 1)
+        return READ_ONCE(row[i]);
+    return ((s64)READ_ONCE(row[i]) +
+            READ_ONCE(row[num_states * NUM_ACTIONS + i])) / 2;
+}
+
+static s32 q_pol_val(struct rl_policy *pol, unsigned int i)
+{
+    if (q_tables == 1)
+        return atomic_read(&pol->qtable[i]);
+    return ((s64)atomic_read(&pol->qtable[i]) +
+            atomic_read(&pol->qtable[num_states * NUM_ACTIONS + i])) / 2;
+}
+
+/* set entry i of every table */
+static void q_pol_set(struct rl_policy *pol, unsigned int i, s32 val)
+{
+    unsigned int t;
 
+    for (t = 0; t < q_tables; t++)
+        atomic_set(&pol->qtable[t * num_states * NUM_ACTIONS + i], val);
+}
+
+static long q_get(struct pid_entry *pe, int s, int a)
+{
+    if (pe->policy)
+        return q_pol_val(pe->policy, QIDX(s, a));
+    return q_row_val(q_row(pe->idx), QIDX(s, a));
+}
+
+/* one table's entry (Double Q-learning) */
+static long q_get_t(struct pid_entry *pe, int t, int s, int a)
+{
+    size_t i = (size_t)t * num_states * NUM_ACTIONS + QIDX(s, a);
+
+    if (pe->policy)
+        return atomic_read(&pe->policy->qtable[i]);
+    return q_row(pe->idx)[i];
+}
+
+static void q_add_t(struct pid_entry *pe, int t, int s, int a, long delta)
+{
+    size_t i = (size_t)t * num_states * NUM_ACTIONS + QIDX(s, a);
+
+    if (pe->policy)
+        atomic_add((int)delta, &pe->policy->qtable[i]);
+    else
+        q_row(pe->idx)[i] += (s32)delta;
+}
+
+/* take a fresh entry for p; may_alloc allows a non-sleeping slab fallback */
+static struct pid_entry *new_pid_entry(struct task_struct *p, bool may_alloc)
+{
+    struct pid_entry *e;
+
+    e = pool_get_entry();
+    if (!e && may_alloc)
+        e = kmem_cache_zalloc(pid_entry_cache, GFP_NOWAIT | __GFP_NOWARN);
+    if (!e)
+        return NULL;
+    if (store_alloc_idx(&e->idx)) {
+        pool_put_entry(e);
+        return NULL;
+    }
+    e->pid = p->pid;
+    e->filter_gen = atomic_read(&filter_gen);
+    e->policy = policy_for_task(p);
+    if (!e->policy)
+        template_apply(p, e->idx);
+    return e;
+}
+
+/*
+ * Shard that should own p's entry: the one of the CPU p is on, else any
+ * online one. The caller holds rcu_read_lock() until it has handed the
+ * entry off, so rl_cpu_offline() can wait for it before its last drain.
+ */
+static struct rl_shard *task_shard(struct task_struct *p)
+{
+    struct rl_shard *sh;
+    int cpu;
+
+    if (!percpu_workers)
+        return &rl_global_shard;
+    sh = per_cpu_ptr(rl_shards, task_cpu(p));
+    if (READ_ONCE(sh->online))
+        return sh;
+    sh = per_cpu_ptr(rl_shards, raw_smp_processor_id());
+    if (READ_ONCE(sh->online))
+        return sh;
+    for_each_online_cpu(cpu) {
+        sh = per_cpu_ptr(rl_shards, cpu);
+        if (READ_ONCE(sh->online))
+            break;
+    }
+    return sh;
+}
+
+/*
+ * Pass a published entry to a shard; never sleeps. Unless the caller is
+ * the hotplug path itself, it must have seen sh online in the same RCU
+ * read section.
+ */
+static void shard_handoff(struct rl_shard *sh, struct pid_entry *e)
+{
+    llist_add(&e->handoff, &sh->inbox);
+}
+
+/* give back an entry that was never published in the table */
+static void discard_pid_entry(struct pid_entry *e)
+{
+    store_free_idx(e->idx);
+    pool_put_entry(e);
+}
+
+/* Find or create pid_entry for p (caller holds rcu_read_lock) */
+static struct pid_entry *get_pid_entry(struct task_struct *p)
+{
+    struct pid_entry *e, *old;
+
+    e = rhashtable_lookup_fast(&pid_table, &p->pid, pid_table_params);
+    if (e)
+        return e;
+
+    if (atomic_read(&pid_table.nelems) >= max_entries)
+        return NULL;
+
+    e = new_pid_entry(p, false);
+    if (!e)
+        return NULL;
+
+    old = rhashtable_lookup_get_insert_fast(&pid_table, &e->node,
+                                            pid_table_params);
+    if (old) {
+        /* lost a race (or table full): use the existing entry, if any */
+        discard_pid_entry(e);
+        return IS_ERR(old) ? NULL : old;
+    }
+    shard_handoff(task_shard(p), e);
+    return e;
+}
+
+/*
+ * Take an entry out of the pid table. It stays on its shard until the
+ * owning worker sees it dead and frees it after a grace period.
+ */
+static void kill_pid_entry(struct pid_entry *e)
+{
+    if (rhashtable_remove_fast(&pid_table, &e->node, pid_table_params) == 0)
+        WRITE_ONCE(e->dead, true);
+}
+
+static void remove_pid_entry(pid_t pid)
+{
+    struct pid_entry *e;
+
+    rcu_read_lock();
+    e = rhashtable_lookup_fast(&pid_table, &pid, pid_table_params);
+    if (e)
+        kill_pid_entry(e);
+    rcu_read_unlock();
+}
+
+/*
+ * Start tracking a task with a fresh entry. An existing entry for the same
+ * pid belongs to a previous incarnation (recycled pid, or the pre-exec image)
+ * and is replaced so no stale Q-table or runtime snapshot is inherited.
+ * After exec (same task) the knob's original value is carried over.
+ * Called from tracepoint context: must not sleep.
+ */
+static void track_task(struct task_struct *p, bool exec)
+{
+    struct pid_entry *e, *old;
+
+    if (atomic_read(&pid_table.nelems) >= max_entries)
+        return;
+
+    e = new_pid_entry(p, true);
+    if (!e) {
+        atomic_set(&resync_needed, 1);
+        return;
+    }
+
+    rcu_read_lock();
+    old = rhashtable_lookup_get_insert_fast(&pid_table, &e->node,
+                                            pid_table_params);
+    if (exec && old && !IS_ERR(old) && smp_load_acquire(&old->has_orig)) {
+        e->orig_val = old->orig_val;
+        e->has_orig = true;
+    }
+    if (old && !IS_ERR(old) &&
+        rhashtable_replace_fast(&pid_table, &old->node, &e->node,
+                                pid_table_params) == 0) {
+        WRITE_ONCE(old->dead, true);
+        old = NULL;
+    }
+    if (!old)
+        shard_handoff(task_shard(p), e);
+    rcu_read_unlock();
+
+    if (old) {
+        /* insert or replace failed: the pid may be left untracked */
+        discard_pid_entry(e);
+        atomic_set(&resync_needed, 1);
+    }
+}
+
+/*
+ * Task filter. Rules come from /sys/kernel/rl_sched/filter, one per line:
+ *   allow|deny comm=<glob>     e.g. deny comm=kworker*
+ *   allow|deny uid=<uid>
+ *   allow|deny cgroup=<glob>   cgroup v2 path, e.g. allow cgroup=/system.slice/*
+ * The first matching rule decides. A task no rule matches is managed
+ * unless allow rules exist. Filters are evaluated at fork, exec and
+ * seeding, before any table lookup or allocation, so unmanaged tasks cost
+ * nothing per tick. Tracked entries are rechecked by the scan after a
+ * rule change.
+ */
+#define RL_MAX_FILTER_RULES 64
+
+enum rl_match {
+    RL_MATCH_COMM = 0,
+    RL_MATCH_UID,
+    RL_MATCH_CGROUP,
+};
+
+static const char * const rl_match_names[] = {
+    [RL_MATCH_COMM]   = "comm",
+    [RL_MATCH_UID]    = "uid",
+    [RL_MATCH_CGROUP] = "cgroup",
+};
+
+struct rl_filter_rule {
+    bool allow;
+    u8 match;                          /* enum rl_match */
+    u32 uid;
+    char pattern[RL_POLICY_NAME_LEN];
+};
+
+struct rl_filter {
+    struct rcu_head rcu;
+    unsigned int nr;
+    bool has_allow;                    /* unmatched tasks are denied */
+    struct rl_filter_rule rules[];
+};
+
+static struct rl_filter __rcu *rl_filter;
+static DEFINE_MUTEX(filter_mutex);
+
+/* shell-style '*' and '?' match (lib/glob.c is not built in every kernel) */
+static bool rl_glob(const char *pat, const char *str)
+{
+    const char *back_pat = NULL, *back_str = NULL;
+
+    while (*str) {
+        if (*pat == '*') {
+            back_pat = ++pat;
+            back_str = str;
+        } else if (*pat == '?' || *pat == *str) {
+            pat++;
+            str++;
+        } else if (back_pat) {
+            pat = back_pat;
+            str = ++back_str;
+        } else {
+            return false;
+        }
+    }
+    while (*pat == '*')
+        pat++;
+    return !*pat;
+}
+
+static bool task_is_rt(struct task_struct *p)
+{
+    int pol = READ_ONCE(p->policy);
+
+    return pol == SCHED_FIFO || pol == SCHED_RR || pol == SCHED_DEADLINE;
+}
+
+static bool filter_allows(struct task_struct *p)
+{
+    char cgpath[RL_POLICY_NAME_LEN] = "";
+    bool have_path = false, ok = true;
+    struct rl_filter *f;
+    unsigned int i;
+
+    rcu_read_lock();
+    f = rcu_dereference(rl_filter);
+    if (!f)
+        goto out;
+    ok = !f->has_allow;
+    for (i = 0; i < f->nr; i++) {
+        const struct rl_filter_rule *r = &f->rules[i];
+        bool hit = false;
+
+        switch (r->match) {
+        case RL_MATCH_COMM:
+            hit = rl_glob(r->pattern, p->comm);
+            break;
+        case RL_MATCH_UID:
+            hit = from_kuid(&init_user_ns, task_uid(p)) == r->uid;
+            break;
+        case RL_MATCH_CGROUP:
+#ifdef CONFIG_CGROUPS
+            if (!have_path) {
+                cgroup_path(task_dfl_cgroup(p), cgpath, sizeof(cgpath));
+                have_path = true;
+            }
+#endif
+            hit = rl_glob(r->pattern, cgpath);
+            break;
+        }
+        if (hit) {
+            ok = r->allow;
+            break;
+        }
+    }
+out:
+    rcu_read_unlock();
+    return ok;
+}
+
+/* parse one "allow|deny key=value" line into the next rule of f */
+static int filter_parse_rule(char *line, struct rl_filter *f)
+{
+    struct rl_filter_rule *r = &f->rules[f->nr];
+    char *verb, *val;
+    int match;
+
+    if (f->nr >= RL_MAX_FILTER_RULES)
+        return -ENOSPC;
+    verb = strsep(&line, " \t");
+    if (!strcmp(verb, "allow"))
+        r->allow = true;
+    else if (strcmp(verb, "deny"))
+        return -EINVAL;
+    if (!line)
+        return -EINVAL;
+    val = strchr(line, '=');
+    if (!val)
+        return -EINVAL;
+    *val++ = '\0';
+    match = match_string(rl_match_names, ARRAY_SIZE(rl_match_names), strim(line));
+    if (match < 0)
+        return match;
+    r->match = match;
+    val = strim(val);
+    if (match == RL_MATCH_UID) {
+        if (kstrtou32(val, 10, &r->uid))
+            return -EINVAL;
+    } else if (strscpy(r->pattern, val, sizeof(r->pattern)) < 0) {
+        return -E2BIG;
+    }
+    f->has_allow |= r->allow;
+    f->nr++;
+    return 0;
+}
+
+/* replace the rule set; tracked tasks are rechecked by the scan */
+static int filter_set(const char *buf, size_t count)
+{
+    struct rl_filter *f, *old;
+    char *copy, *cur, *line;
+    int ret = 0;
+
+    f = kzalloc(struct_size(f, rules, RL_MAX_FILTER_RULES), GFP_KERNEL);
+    copy = kstrndup(buf, count, GFP_KERNEL);
+    if (!f || !copy) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    cur = copy;
+    while ((line = strsep(&cur, "\n"))) {
+        line = strim(line);
+        if (!*line || *line == '#')
+            continue;
+        ret = filter_parse_rule(line, f);
+        if (ret)
+            goto out;
+    }
+    if (!f->nr) {
+        kfree(f);
+        f = NULL;
+    }
+
+    mutex_lock(&filter_mutex);
+    old = rcu_dereference_protected(rl_filter, lockdep_is_held(&filter_mutex));
+    rcu_assign_pointer(rl_filter, f);
+    mutex_unlock(&filter_mutex);
+    f = NULL;
+    if (old)
+        kfree_rcu(old, rcu);
+    atomic_inc(&filter_gen);
+out:
+    kfree(copy);
+    kfree(f);
+    return ret;
+}
+
+static ssize_t filter_emit(char *buf)
+{
+    struct rl_filter *f;
+    ssize_t len = 0;
+    unsigned int i;
+
+    rcu_read_lock();
+    f = rcu_dereference(rl_filter);
+    for (i = 0; f && i < f->nr; i++) {
+        const struct rl_filter_rule *r = &f->rules[i];
+
+        len += sysfs_emit_at(buf, len, "%s %s=", r->allow ? "allow" : "deny",
+                             rl_match_names[r->match]);
+        if (r->match == RL_MATCH_UID)
+            len += sysfs_emit_at(buf, len, "%u\n", r->uid);
+        else
+            len += sysfs_emit_at(buf, len, "%s\n", r->pattern);
+    }
+    rcu_read_unlock();
+    return len;
+}
+
+/* is p managed at all: scope, task class and filter rules? */
+static bool task_is_tracked(struct task_struct *p)
+{
+    if (scope != RL_SCOPE_THREAD && !thread_group_leader(p))
+        return false;
+    if (READ_ONCE(skip_kthreads) && (p->flags & PF_KTHREAD))
+        return false;
+    if (READ_ONCE(skip_rt) && task_is_rt(p))
+        return false;
+    return filter_allows(p);
+}
+
+/*
+ * Scan-time check of a tracked entry (owner only): drop it if a filter
+ * change excludes it now, and leave tasks alone while they run RT.
+ */
+static bool entry_managed(struct pid_entry *pe, struct task_struct *p)
+{
+    u32 gen = atomic_read(&filter_gen);
+
+    if (unlikely(pe->filter_gen != gen)) {
+        pe->filter_gen = gen;
+        if (!task_is_tracked(p)) {
+            kill_pid_entry(pe);
+            return false;
+        }
+    }
+    return !(READ_ONCE(skip_rt) && task_is_rt(p));
+}
+
+/* tasks visited per RCU read section while seeding */
+#define RL_SEED_BATCH 1024
+
+/*
+ * Leave the RCU read section of a task list walk to refill the pool and
+ * reschedule, with g and t pinned (as the hung task detector does).
+ * Returns false if either left the task list meanwhile, so the walk
+ * cannot resume from them.
+ */
+static bool seed_lock_break(struct task_struct *g, struct task_struct *t)
+{
+    bool alive;
+
+    get_task_struct(g);
+    get_task_struct(t);
+    rcu_read_unlock();
+    pool_refill();
+    cond_resched();
+    rcu_read_lock();
+    alive = pid_alive(g) && pid_alive(t);
+    put_task_struct(t);
+    put_task_struct(g);
+    return alive;
+}
+
+/*
+ * Add every live task (leader or thread, per scope) not tracked yet; may
+ * sleep. The walk drops RCU every RL_SEED_BATCH tasks and whenever the
+ * pool runs dry. If a refill brings nothing the seed gives up until the
+ * next resync; if its cursor exits it asks for one.
+ */
+static void seed_pid_table(void)
+{
+    struct task_struct *g, *p;
+    int left = RL_SEED_BATCH;
+
+    pool_refill();
+
+    rcu_read_lock();
+    for_each_process_thread(g, p) {
+        if (!task_is_tracked(p) || p->exit_state)
+            goto next;
+        if (atomic_read(&pid_table.nelems) >= max_entries)
+            goto out;
+        if (get_pid_entry(p) || READ_ONCE(entry_pool.nr))
+            goto next;
+        /* pool ran dry: refill and retry p once */
+        if (!seed_lock_break(g, p))
+            goto resync;
+        if (!READ_ONCE(entry_pool.nr))
+            goto out;
+        if (!p->exit_state)
+            get_pid_entry(p);
+        left = RL_SEED_BATCH;
+next:
+        if (--left)
+            continue;
+        left = RL_SEED_BATCH;
+        if (kthread_should_stop())
+            goto out;
+        if (!seed_lock_break(g, p))
+            goto resync;
+    }
+out:
+    rcu_read_unlock();
+    return;
+resync:
+    rcu_read_unlock();
+    atomic_set(&resync_needed, 1);
+}
+
+/* tracepoint probes (signatures follow include/trace/events/sched.h) */
+static void rl_probe_fork(void *data, struct task_struct *parent,
+                          struct task_struct *child)
+{
+    if (task_is_tracked(child))
+        track_task(child, false);
+}
+
+static void rl_probe_exec(void *data, struct task_struct *p, pid_t old_pid,
+                          struct linux_binprm *bprm)
+{
+    /* a non-leader exec takes over the leader's pid */
+    if (old_pid != p->pid)
+        remove_pid_entry(old_pid);
+    /* new program image: learn it from scratch, if the new comm is managed */
+    if (task_is_tracked(p))
+        track_task(p, true);
+    else
+        remove_pid_entry(p->pid);
+}
+
+static void rl_probe_exit(void *data, struct task_struct *p)
+{
+    /* filters may have changed since fork; only the scope is stable */
+    if (scope == RL_SCOPE_THREAD || thread_group_leader(p))
+        remove_pid_entry(p->pid);
+}
+
+static struct rl_tracepoint {
+    const char *name;
+    void *probe;
+    struct tracepoint *tp;
+    bool registered;
+} rl_tracepoints[] = {
+    { .name = "sched_process_fork", .probe = rl_probe_fork },
+    { .name = "sched_process_exec", .probe = rl_probe_exec },
+    { .name = "sched_process_exit", .probe = rl_probe_exit },
+};
+
+/* the sched tracepoints are not exported to modules; look them up by name */
+static void rl_lookup_tracepoint(struct tracepoint *tp, void *priv)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(rl_tracepoints); i++) {
+        if (!strcmp(tp->name, rl_tracepoints[i].name))
+            rl_tracepoints[i].tp = tp;
+    }
+}
+
+static void unregister_lifecycle_probes(void)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(rl_tracepoints); i++) {
+        if (!rl_tracepoints[i].registered)
+            continue;
+        tracepoint_probe_unregister(rl_tracepoints[i].tp,
+                                    rl_tracepoints[i].probe, NULL);
+        rl_tracepoints[i].registered = false;
+    }
+    tracepoint_synchronize_unregister();
+}
+
+static int register_lifecycle_probes(void)
+{
+    int i, ret;
+
+    for_each_kernel_tracepoint(rl_lookup_tracepoint, NULL);
+
+    for (i = 0; i < ARRAY_SIZE(rl_tracepoints); i++) {
+        if (!rl_tracepoints[i].tp) {
+            pr_err("rl_sched_mod: tracepoint %s not found\n",
+                   rl_tracepoints[i].name);
+            ret = -ENOENT;
+            goto fail;
+        }
+        ret = tracepoint_probe_register(rl_tracepoints[i].tp,
+                                        rl_tracepoints[i].probe, NULL);
+        if (ret) {
+            pr_err("rl_sched_mod: failed to attach to %s\n",
+                   rl_tracepoints[i].name);
+            goto fail;
+        }
+        rl_tracepoints[i].registered = true;
+    }
+    return 0;
+
+fail:
+    unregister_lifecycle_probes();
+    return ret;
+}
+
+/* clamp nice between -20 and 19 */
+static int clamp_nice(int nice)
+{
+    if (nice < -20) return -20;
+    if (nice > 19) return 19;
+    return nice;
+}
+
+/* exploration rate (permille) for pe in state st, per epsilon_decay */
+static int rl_epsilon(struct pid_entry *pe, int st)
+{
+    int eps = READ_ONCE(epsilon_permille);
+    int lo = min(READ_ONCE(epsilon_min_permille), eps);
+    u64 k = READ_ONCE(epsilon_decay_k), n;
+
+    switch (READ_ONCE(epsilon_decay)) {
+    case RL_DECAY_VISITS:
+        n = rl_store.visits[(size_t)pe->idx * num_states + st];
+        break;
+    case RL_DECAY_TICKS:
+        n = div64_u64(ktime_get_ns() - rl_start_ns, rl_interval_ns());
+        break;
+    default:
+        return eps;
+    }
+    if (eps <= 0)
+        return eps;
+    return max_t(int, lo, k ? div64_u64((u64)eps * k, k + n) : 0);
+}
+
+/* greedy action in st over table t, or over the mean of all for t < 0 */
+static int q_argmax(struct pid_entry *pe, int t, int st, long *best_q)
+{
+    long best = LONG_MIN;
+    int best_a = 0, a;
+
+    for (a = 0; a < NUM_ACTIONS; a++) {
+        long val = t < 0 ? q_get(pe, st, a) : q_get_t(pe, t, st, a);
+
+        if (val > best) {
+            best = val;
+            best_a = a;
+        }
+    }
+    if (best_q)
+        *best_q = best;
+    return best_a;
+}
+
+/*
+ * choose action with epsilon-greedy on qtable row; greedy only unless
+ * learning. *explore tells whether the action is off the greedy choice: a
+ * random pick that happens to be the best action does not count.
+ */
+static int choose_action(struct pid_entry *pe, int st, bool *explore)
+{
+    u32 r = get_random_u32() % 1000; /* 0..999 */
+    if (READ_ONCE(rl_mode) == RL_MODE_LEARN && r < rl_epsilon(pe, st)) {
+        int a = get_random_u32() % NUM_ACTIONS;
+
+        trace_rl_choose(pe->pid, st, a, true, q_get(pe, st, a));
+        *explore = a != q_argmax(pe, -1, st, NULL);
+        return a;
+    } else {
+        long best;
+        int best_a = q_argmax(pe, -1, st, &best);
+
+        trace_rl_choose(pe->pid, st, best_a, false, best);
+        *explore = false;
+        return best_a;
+    }
+}
+
+/* move table t's Q(s, a) by alpha * td / 1000; returns the change */
+static long q_step(struct pid_entry *pe, int t, int s, int a, long td,
+                   long reward, int s_next)
+{
+    long q = q_get_t(pe, t, s, a);
+    long delta = (alpha_permille * td) / 1000;
+
+    q_add_t(pe, t, s, a, delta);
+    trace_rl_q_update(pe->pid, s, a, reward, s_next, q, delta);
+    return delta;
+}
+
+/*
+ * Watkins's Q(lambda) with a truncated trace: push (s, a), then move each
+ * pair of the trace by the TD error weighted (gamma * lambda)^age. A pair
+ * seen again only counts at its latest age (replacing traces). When the
+ * next action is off the greedy policy the greedy return no longer
+ * follows, so the trace is cut. Returns the summed |Q change|.
+ */
+static long q_lambda_update(struct pid_entry *pe, int s, int a, long td,
+                            long reward, int s_next, bool off_policy)
+{
+    u32 *tr = &rl_store.trace[(size_t)pe->idx * RL_TRACE_LEN];
+    u8 *len = &rl_store.trace_len[pe->idx];
+    long decay = (long)gamma_permille * READ_ONCE(lambda_permille) / 1000;
+    long w = 1000, sum = 0;
+    u32 cur = (u32)s << 8 | a;
+    int i, j, n = *len;
+
+    /* newest first: drop an older copy of (s, a), or the oldest pair */
+    for (i = 0; i < n && tr[i] != cur; i++)
+        ;
+    if (i == n && n < RL_TRACE_LEN)
+        n++;
+    for (j = min(i, n - 1); j > 0; j--)
+        tr[j] = tr[j - 1];
+    tr[0] = cur;
+    *len = n;
+
+    for (i = 0; i < n && w; i++) {
+        sum += abs(q_step(pe, 0, tr[i] >> 8, tr[i] & 0xff, td * w / 1000,
+                          reward, s_next));
+        w = w * decay / 1000;
+    }
+
+    if (off_policy)
+        *len = 0;
+    return sum;
+}
+
+/*
+ * Learning update for the transition (s, a) -> reward, s_next, after
+ * which a_next is taken; off_policy if that is not the greedy choice
+ * (explored, or suppressed to a no-op). Per algo (all values in permille
+ * scaling).
+ * The TD target is reward + gamma * Q(s_next, x)/1000 with x:
+ *   Q-learning, Q(lambda): the best action in s_next
+ *   SARSA:                 a_next
+ *   Double Q-learning:     the best action in s_next by one table (picked
+ *                          at random), rated and updated with the other
+ * Returns the summed |Q change|.
+ */
+static long q_update(struct pid_entry *pe, int s, int a, long reward,
+                     int s_next, int a_next, bool off_policy)
+{
+    long q, next, td;
+    int t = 0;
+
+    switch (algo) {
+    case RL_ALGO_SARSA:
+        next = q_get(pe, s_next, a_next);
+        break;
+    case RL_ALGO_DOUBLE_Q:
+        t = get_random_u32() & 1;
+        next = q_get_t(pe, !t, s_next, q_argmax(pe, t, s_next, NULL));
+        break;
+    default:
+        q_argmax(pe, 0, s_next, &next);
+        break;
+    }
+    q = q_get_t(pe, t, s, a);
+
+    /*
+     * Q’ = Q + α * (reward + γ*next − Q) / 1000, applied as a delta
+     * so concurrent updates to a shared table add up instead of clobbering.
+     */
+    td = reward + (gamma_permille * next) / 1000 - q;
+    if (algo == RL_ALGO_Q_LAMBDA)
+        return q_lambda_update(pe, s, a, td, reward, s_next, off_policy);
+    return abs(q_step(pe, t, s, a, td, reward, s_next));
+}
+
+/*
+ * Sample the counters the agent for p is judged on: the task's own, or for
+ * the process scope the whole thread group, including the runtime and
+ * context switches of threads that already exited (caller holds
+ * rcu_read_lock).
+ */
+static void sample_add_thread(struct rl_sample *smp, struct task_struct *t)
+{
+    smp->runtime += t->se.sum_exec_runtime;
+#ifdef CONFIG_SCHED_INFO
+    smp->run_delay += t->sched_info.run_delay;
+#endif
+    smp->nvcsw += READ_ONCE(t->nvcsw);
+    smp->nivcsw += READ_ONCE(t->nivcsw);
+#ifdef CONFIG_SMP
+    smp->util += READ_ONCE(t->se.avg.util_avg);
+#endif
+    smp->nr_queued += !!READ_ONCE(t->on_rq);
+}
+
+static void task_sample(struct task_struct *p, struct rl_sample *smp)
+{
+    struct task_struct *t;
+
+    memset(smp, 0, sizeof(*smp));
+    if (scope != RL_SCOPE_PROCESS) {
+        sample_add_thread(smp, p);
+        return;
+    }
+
+    smp->runtime = READ_ONCE(p->signal->sum_sched_runtime);
+    smp->nvcsw = READ_ONCE(p->signal->nvcsw);
+    smp->nivcsw = READ_ONCE(p->signal->nivcsw);
+    for_each_thread(p, t)
+        sample_add_thread(smp, t);
+}
+
+/* rescale a delta observed over elapsed ns to one sampling interval */
+static u64 scale_delta(u64 delta, u64 elapsed)
+{
+    u64 interval_ns = rl_interval_ns();
+
+    /*
+     * A budgeted scan can revisit a task after more than one interval;
+     * rescale so the state thresholds always mean "per interval".
+     */
+    if (elapsed && interval_ns && elapsed != interval_ns)
+        delta = mul_u64_u64_div_u64(delta, interval_ns, elapsed);
+    return delta;
+}
+
+/* counter delta since the last visit, rescaled to one sampling interval */
+static u64 interval_delta(u64 cur, u64 prev, u64 elapsed)
+{
+    /* exited threads can shrink process-scope sums */
+    return scale_delta(cur >= prev ? cur - prev : 0, elapsed);
+}
+
+/*
+ * Actuators. Each maps the three actions onto one knob: DEC_NICE moves it
+ * towards more CPU, INC_NICE towards less, NOOP leaves it. get() reads
+ * the knob as a number, next() computes the value an action leads to and
+ * set() applies it. Actuation runs after the scan's RCU section, in
+ * process context with a reference on the task, so set() may sleep.
+ * Knobs of per_thread actuators are synced to every thread in the process
+ * scope; their get() must not sleep.
+ */
+struct rl_actuator {
+    const char *name;
+    bool per_thread;
+    int (*get)(struct task_struct *p, long *val);
+    long (*next)(long cur, int action);
+    int (*set)(struct task_struct *p, long val);
+};
+
+static int nice_get(struct task_struct *p, long *val)
+{
+    *val = task_nice(p);
+    return 0;
+}
+
+static long nice_next(long cur, int action)
+{
+    if (action == RL_DEC_NICE)
+        cur -= action_step;
+    else if (action == RL_INC_NICE)
+        cur += action_step;
+    return clamp_nice(cur);
+}
+
+static int nice_set(struct task_struct *p, long val)
+{
+    set_user_nice(p, val);
+    return 0;
+}
+
+#ifdef CONFIG_CGROUPS
+/*
+ * cpu.weight of a cgroup (path relative to cgroup_root), through the
+ * cgroup v2 filesystem as the kernel exports no call for it. The root
+ * cgroup and groups without the cpu controller have no such file.
+ */
+static struct file *cgroup_weight_open(const char *cgpath, int flags)
+{
+    struct file *f;
+    char *path;
+
+    path = kasprintf(GFP_KERNEL, "%s%s/cpu.weight", cgroup_root, cgpath);
+    if (!path)
+        return ERR_PTR(-ENOMEM);
+    f = filp_open(path, flags, 0);
+    kfree(path);
+    return f;
+}
+
+static int cgroup_weight_get(const char *cgpath, long *val)
+{
+    struct file *f = cgroup_weight_open(cgpath, O_RDONLY);
+    char buf[16] = {};
+    loff_t pos = 0;
+    unsigned int w;
+    ssize_t n;
+    int ret;
+
+    if (IS_ERR(f))
+        return PTR_ERR(f);
+    n = kernel_read(f, buf, sizeof(buf) - 1, &pos);
+    filp_close(f, NULL);
+    if (n < 0)
+        return n;
+    ret = kstrtouint(strim(buf), 10, &w);
+    if (ret)
+        return ret;
+    *val = w;
+    return 0;
+}
+
+static int cgroup_weight_set(const char *cgpath, long val)
+{
+    struct file *f = cgroup_weight_open(cgpath, O_WRONLY);
+    char buf[16];
+    loff_t pos = 0;
+    ssize_t n;
+    int len;
+
+    if (IS_ERR(f))
+        return PTR_ERR(f);
+    len = scnprintf(buf, sizeof(buf), "%ld\n", val);
+    n = kernel_write(f, buf, len, &pos);
+    filp_close(f, NULL);
+    return n < 0 ? n : 0;
+}
+
+/* cpu.weight of the task's own cgroup */
+static int weight_get(struct task_struct *p, long *val)
+{
+    char *cgpath = kmalloc(PATH_MAX, GFP_KERNEL);
+    int ret;
+
+    if (!cgpath)
+        return -ENOMEM;
+    rcu_read_lock();
+    cgroup_path(task_dfl_cgroup(p), cgpath, PATH_MAX);
+    rcu_read_unlock();
+    ret = cgroup_weight_get(cgpath, val);
+    kfree(cgpath);
+    return ret;
+}
+
+static int weight_set(struct task_struct *p, long val)
+{
+    char *cgpath = kmalloc(PATH_MAX, GFP_KERNEL);
+    int ret;
+
+    if (!cgpath)
+        return -ENOMEM;
+    rcu_read_lock();
+    cgroup_path(task_dfl_cgroup(p), cgpath, PATH_MAX);
+    rcu_read_unlock();
+    ret = cgroup_weight_set(cgpath, val);
+    kfree(cgpath);
+    return ret;
+}
+
+static long weight_next(long cur, int action)
+{
+    long pct = READ_ONCE(weight_step_pct);
+
+    if (action == RL_DEC_NICE)
+        cur += max(cur * pct / 100, 1L);
+    else if (action == RL_INC_NICE)
+        cur = cur * 100 / (100 + pct);
+    return clamp(cur, (long)CGROUP_WEIGHT_MIN, (long)CGROUP_WEIGHT_MAX);
+}
+
+/*
+ * cpu.weight is one knob per cgroup, moved by every task agent in it and
+ * by its group agent, so its value before the first change is kept once
+ * per cgroup, by id (ids are never reused), and restored once.
+ */
+struct rl_cgweight {
+    struct hlist_node node;
+    u64 id;
+    long orig;
+    char path[];                /* relative to cgroup_root */
+};
+
+static DEFINE_HASHTABLE(cgweight_table, 6);
+static DEFINE_MUTEX(cgweight_mutex);
+
+/* find, or add with weight cur as the original; caller holds cgweight_mutex */
+static struct rl_cgweight *cgweight_get(u64 id, const char *cgpath, long cur)
+{
+    struct rl_cgweight *w;
+
+    hash_for_each_possible(cgweight_table, w, node, id)
+        if (w->id == id)
+            return w;
+    w = kmalloc(struct_size(w, path, strlen(cgpath) + 1), GFP_KERNEL);
+    if (w) {
+        w->id = id;
+        w->orig = cur;
+        strcpy(w->path, cgpath);
+        hash_add(cgweight_table, &w->node, id);
+    }
+    return w;
+}
+
+/* remember weight cur of cgroup id unless already known; may sleep */
+static void cgweight_save(u64 id, const char *cgpath, long cur)
+{
+    mutex_lock(&cgweight_mutex);
+    cgweight_get(id, cgpath, cur);
+    mutex_unlock(&cgweight_mutex);
+}
+
+/* same, for the cgroup p is in */
+static void weight_save_orig(struct task_struct *p, long cur)
+{
+    char *cgpath = kmalloc(PATH_MAX, GFP_KERNEL);
+    u64 id;
+
+    if (!cgpath)
+        return;
+    rcu_read_lock();
+    id = cgroup_id(task_dfl_cgroup(p));
+    cgroup_path(task_dfl_cgroup(p), cgpath, PATH_MAX);
+    rcu_read_unlock();
+    cgweight_save(id, cgpath, cur);
+    kfree(cgpath);
+}
+
+/*
+ * All task agents of a cgroup share its weight, so without a limit one
+ * batch would compound weight_step_pct once per member. A task agent
+ * claims its cgroup when an action is let through, see action_allowed();
+ * the claim fails if any agent claimed the cgroup within the last half
+ * tick period.
+ */
+struct rl_cgclaim {
+    struct hlist_node node;
+    u64 id;
+    u64 last_ns;
+};
+
+static DEFINE_HASHTABLE(cgclaim_table, 6);
+static DEFINE_MUTEX(cgclaim_mutex);
+
+static bool cgweight_claim(u64 id)
+{
+    u64 now = ktime_get_ns(); /* claims come from several workers */
+    struct rl_cgclaim *c;
+    bool ok = true;
+
+    mutex_lock(&cgclaim_mutex);
+    hash_for_each_possible(cgclaim_table, c, node, id) {
+        if (c->id == id) {
+            ok = now - c->last_ns >= READ_ONCE(effective_interval_ns) / 2;
+            if (ok)
+                c->last_ns = now;
+            goto out;
+        }
+    }
+    c = kmalloc(sizeof(*c), GFP_KERNEL);
+    if (c) {
+        c->id = id;
+        c->last_ns = now;
+        hash_add(cgclaim_table, &c->node, id);
+    }
+out:
+    mutex_unlock(&cgclaim_mutex);
+    return ok;
+}
+
+static void cgclaim_free_all(void)
+{
+    struct rl_cgclaim *c;
+    struct hlist_node *tmp;
+    int bkt;
+
+    mutex_lock(&cgclaim_mutex);
+    hash_for_each_safe(cgclaim_table, bkt, tmp, c, node) {
+        hash_del(&c->node);
+        kfree(c);
+    }
+    mutex_unlock(&cgclaim_mutex);
+}
+
+/* write back and forget one saved weight, if its cgroup still exists */
+static void cgweight_put_back(struct rl_cgweight *w)
+{
+    struct cgroup *cgrp = cgroup_get_from_path(w->path);
+    int err;
+
+    if (!IS_ERR(cgrp)) {
+        /* a cgroup recreated under the same path is not ours */
+        if (cgroup_id(cgrp) == w->id) {
+            err = cgroup_weight_set(w->path, w->orig);
+            if (err && err != -ENOENT)
+                atomic_long_inc(&actuate_errors);
+        }
+        cgroup_put(cgrp);
+    }
+    hash_del(&w->node);
+    kfree(w);
+}
+
+/* restore cgroup id's weight (all cgroups for id 0); may sleep */
+static void cgweight_restore(u64 id)
+{
+    struct rl_cgweight *w;
+    struct hlist_node *tmp;
+    int bkt;
+
+    mutex_lock(&cgweight_mutex);
+    hash_for_each_safe(cgweight_table, bkt, tmp, w, node) {
+        if (!id || w->id == id)
+            cgweight_put_back(w);
+    }
+    mutex_unlock(&cgweight_mutex);
+}
+#endif
+
+/* scheduling policy as a rung: SCHED_IDLE=0 < SCHED_BATCH=1 < SCHED_NORMAL=2 */
+static const int rl_policy_ladder[] = { SCHED_IDLE, SCHED_BATCH, SCHED_NORMAL };
+
+/* rung of p's policy, or -EPERM: real-time and deadline tasks are left alone */
+static int policy_rung(struct task_struct *p)
+{
+    int i, pol = READ_ONCE(p->policy);
+
+    for (i = 0; i < ARRAY_SIZE(rl_policy_ladder); i++)
+        if (rl_policy_ladder[i] == pol)
+            return i;
+    return -EPERM;
+}
+
+/*
+ * sched_setattr_nocheck() applies the attr as given: SCHED_FLAG_KEEP_*
+ * are only honoured by the syscall. So the setters fill in everything
+ * they keep, reset-on-fork included. They only touch fair tasks, whose
+ * sched_priority is 0.
+ */
+static u64 keep_reset_on_fork(struct task_struct *p)
+{
+    return p->sched_reset_on_fork ? SCHED_FLAG_RESET_ON_FORK : 0;
+}
+
+static int schedpol_get(struct task_struct *p, long *val)
+{
+    int rung = policy_rung(p);
+
+    if (rung < 0)
+        return rung;
+    *val = rung;
+    return 0;
+}
+
+static long schedpol_next(long cur, int action)
+{
+    if (action == RL_DEC_NICE)
+        cur++;
+    else if (action == RL_INC_NICE)
+        cur--;
+    return clamp(cur, 0L, (long)ARRAY_SIZE(rl_policy_ladder) - 1);
+}
+
+static int schedpol_set(struct task_struct *p, long val)
+{
+    struct sched_attr attr = {
+        .size         = sizeof(attr),
+        .sched_policy = rl_policy_ladder[val],
+        .sched_flags  = keep_reset_on_fork(p),
+        .sched_nice   = task_nice(p),
+    };
+
+    if (policy_rung(p) < 0)
+        return -EPERM; /* turned real-time since get() */
+    return sched_setattr_nocheck(p, &attr);
+}
+
+#ifdef CONFIG_UCLAMP_TASK
+/*
+ * uclamp as one level in 0..2048: up to 1024 it is the max clamp with
+ * min at 0, above that 1024 + the min clamp with max at 1024. Boosting
+ * first lifts the cap, then raises the floor.
+ */
+static int uclamp_get(struct task_struct *p, long *val)
+{
+    unsigned int lo = p->uclamp_req[UCLAMP_MIN].value;
+    unsigned int hi = p->uclamp_req[UCLAMP_MAX].value;
+
+    if (policy_rung(p) < 0)
+        return -EPERM;
+    *val = hi < SCHED_CAPACITY_SCALE ? hi : SCHED_CAPACITY_SCALE + lo;
+    return 0;
+}
+
+static long uclamp_next(long cur, int action)
+{
+    long step = READ_ONCE(uclamp_step);
+
+    if (action == RL_DEC_NICE)
+        cur += step;
+    else if (action == RL_INC_NICE)
+        cur -= step;
+    return clamp(cur, 0L, 2L * SCHED_CAPACITY_SCALE);
+}
+
+static int uclamp_set(struct task_struct *p, long val)
+{
+    struct sched_attr attr = {
+        .size           = sizeof(attr),
+        .sched_policy   = READ_ONCE(p->policy),
+        .sched_flags    = SCHED_FLAG_UTIL_CLAMP | keep_reset_on_fork(p),
+        .sched_nice     = task_nice(p),
+        .sched_util_min = max(val - SCHED_CAPACITY_SCALE, 0L),
+        .sched_util_max = min(val, (long)SCHED_CAPACITY_SCALE),
+    };
+
+    if (policy_rung(p) < 0)
+        return -EPERM; /* turned real-time since get() */
+    return sched_setattr_nocheck(p, &attr);
+}
+#endif
+
+/* backends this kernel's config lacks have no set() */
+static const struct rl_actuator rl_actuators[RL_NR_ACTUATORS] = {
+    [RL_ACT_NICE]   = { "nice", true, nice_get, nice_next, nice_set },
+#ifdef CONFIG_CGROUPS
+    [RL_ACT_WEIGHT] = { "weight", false, weight_get, weight_next, weight_set },
+#else
+    [RL_ACT_WEIGHT] = { "weight" },
+#endif
+    [RL_ACT_POLICY] = { "policy", true, schedpol_get, schedpol_next, schedpol_set },
+#ifdef CONFIG_UCLAMP_TASK
+    [RL_ACT_UCLAMP] = { "uclamp", true, uclamp_get, uclamp_next, uclamp_set },
+#else
+    [RL_ACT_UCLAMP] = { "uclamp" },
+#endif
+};
+
+static void actuate_error(const struct rl_actuator *act, struct task_struct *p,
+                          int err)
+{
+    if (err == -ENOENT || err == -EPERM)
+        return; /* the task has no such knob */
+    atomic_long_inc(&actuate_errors);
+    pr_debug("rl_sched_mod: %s actuator failed on PID %d: %d\n",
+             act->name, p->pid, err);
+}
+
+/*
+ * Bring every other thread of p's process to val. The threads that differ
+ * are collected, referenced, in one pass under RCU and then set one at a
+ * time, since set() may sleep. Threads created meanwhile wait for the
+ * next tick.
+ */
+static void actuate_threads(const struct rl_actuator *act,
+                            struct task_struct *p, long val)
+{
+    int nr = get_nr_threads(p), n = 0, i, err;
+    struct task_struct **threads, *t;
+    long cur;
+
+    if (nr <= 1)
+        return;
+    threads = kmalloc_array(nr, sizeof(*threads), GFP_KERNEL);
+    if (!threads) {
+        atomic_long_inc(&actuate_errors);
+        return;
+    }
+
+    rcu_read_lock();
+    for_each_thread(p, t) {
+        if (n == nr)
+            break;
+        if (t != p && !act->get(t, &cur) && cur != val) {
+            get_task_struct(t);
+            threads[n++] = t;
+        }
+    }
+    rcu_read_unlock();
+
+    for (i = 0; i < n; i++) {
+        err = act->set(threads[i], val);
+        if (err)
+            actuate_error(act, threads[i], err);
+        put_task_struct(threads[i]);
+        cond_resched();
+    }
+    kfree(threads);
+}
+
+/*
+ * Apply one chosen action to pe's task (and its threads for process
+ * scope), remembering the knob's value before the first change (per
+ * cgroup for cpu.weight, see cgweight_save()). Returns
+ * true if the knob moved, or with dry_run would have moved.
+ */
+static bool actuate(struct pid_entry *pe, struct task_struct *p, int action)
+{
+    const struct rl_actuator *act = &rl_actuators[actuator];
+    bool dry = READ_ONCE(dry_run);
+    bool sync = scope == RL_SCOPE_PROCESS && act->per_thread;
+    long cur, val;
+    int err;
+
+    /* nothing to change, and no threads to bring in line: skip get() */
+    if (action == RL_NOOP && !sync)
+        return false;
+    err = act->get(p, &cur);
+    if (err) {
+        actuate_error(act, p, err);
+        return false;
+    }
+    val = act->next(cur, action);
+    if (val != cur) {
+        trace_rl_actuate(p, actuator, action, cur, val, dry);
+        if (unlikely(READ_ONCE(debug)))
+            pr_info("rl_sched_mod: PID %d (%s) action=%d %s: %ld -> %ld%s\n",
+                    p->pid, p->comm, action, act->name, cur, val,
+                    dry ? " (dry run)" : "");
+        if (!dry) {
+#ifdef CONFIG_CGROUPS
+            if (actuator == RL_ACT_WEIGHT)
+                weight_save_orig(p, cur);
+            else
+#endif
+            if (!pe->has_orig) {
+                pe->orig_val = cur;
+                smp_store_release(&pe->has_orig, true);
+            }
+            err = act->set(p, val);
+            if (err)
+                actuate_error(act, p, err);
+        }
+    }
+
+    if (!dry && sync)
+        actuate_threads(act, p, val);
+    return val != cur;
+}
+
+/* put p's knob (and its threads' for process scope) back to val; may sleep */
+static void restore_knob(struct task_struct *p, long val)
+{
+    const struct rl_actuator *act = &rl_actuators[actuator];
+    long cur;
+    int err;
+
+    err = act->get(p, &cur);
+    if (!err && cur != val) {
+        if (unlikely(READ_ONCE(debug)))
+            pr_info("rl_sched_mod: PID %d (%s) %s restored: %ld -> %ld\n",
+                    p->pid, p->comm, act->name, cur, val);
+        err = act->set(p, val);
+    }
+    if (err)
+        actuate_error(act, p, err);
+    if (scope == RL_SCOPE_PROCESS && act->per_thread)
+        actuate_threads(act, p, val);
+}
+
+static int snap_cpu_cmp(const void *a, const void *b)
+{
+    const struct rl_snap *x = a, *y = b;
+
+    return x->cpu - y->cpu;
+}
+
+/*
+ * Churn limits on a boost or penalize action (owner only). With
+ * hysteresis, actions add up per task, opposite ones cancelling, and only
+ * a net run of hysteresis actions the same way gets through. Then the
+ * task's min_dwell_ms and the worker's max_actions_per_tick must allow a
+ * change, and for the weight actuator the task's cgroup cgrp must not
+ * have moved this tick (0 skips that check). An action let through takes
+ * a slot of the tick budget and claims cgrp. Returns
+ * false, counting why, if the action is to be dropped. Runs before the
+ * learning step, so the update credits the action actually taken.
+ */
+static bool action_allowed(struct rl_shard *sh, struct pid_entry *pe,
+                           int action, u64 now, u64 cgrp)
+{
+    int band = min_t(unsigned int, READ_ONCE(hysteresis), S8_MAX);
+    u64 dwell = (u64)READ_ONCE(min_dwell_ms) * NSEC_PER_MSEC;
+    unsigned int cap = READ_ONCE(max_actions_per_tick);
+    int why;
+
+    if (band > 1) {
+        pe->pending += action == RL_DEC_NICE ? 1 : -1;
+        if (abs(pe->pending) < band) {
+            why = RL_SUPPRESS_HYSTERESIS;
+            goto suppress;
+        }
+        pe->pending = 0;
+    }
+    if (dwell && pe->last_change_ns && now - pe->last_change_ns < dwell) {
+        why = RL_SUPPRESS_DWELL;
+        goto suppress;
+    }
+    if (cap && sh->tick_changes >= cap) {
+        why = RL_SUPPRESS_BUDGET;
+        goto suppress;
+    }
+#ifdef CONFIG_CGROUPS
+    if (cgrp && !cgweight_claim(cgrp)) {
+        why = RL_SUPPRESS_CGROUP;
+        goto suppress;
+    }
+#endif
+    sh->tick_changes++;
+    return true;
+
+suppress:
+    sh->stats.suppressed[why]++;
+    return false;
+}
+
+/*
+ * Actuation phase: apply the batch's actions, CPU by CPU, and drop the
+ * task references of the snapshot. Churn limits were applied when the
+ * actions were chosen. Outside RCU, may sleep.
+ */
+static void actuate_batch(struct rl_shard *sh)
+{
+    struct rl_batch *b = sh->batch;
+    u64 now = ktime_get_ns();
+    unsigned int i;
+
+    sort(b->snap, b->n, sizeof(b->snap[0]), snap_cpu_cmp, NULL);
+    for (i = 0; i < b->n; i++) {
+        struct rl_snap *sn = &b->snap[i];
+
+        if (sn->action == RL_RESTORE) {
+            restore_knob(sn->task, sn->restore_val);
+        } else if (sn->action != RL_NO_ACTION) {
+            if (actuate(sn->pe, sn->task, sn->action)) {
+                sn->pe->last_change_ns = now;
+                sh->stats.knob_changes++;
+            }
+        }
+        put_task_struct(sn->task);
+    }
+    b->n = 0;
+}
+
+/*
+ * Reward for the last interval: credit CPU progress, penalize time spent
+ * waiting on a runqueue and overall CPU pressure. The weights set the
+ * latency vs throughput tradeoff; reward_cpu_permille = -1000 with the
+ * other weights at 0 gives the original "-(ms of CPU used)" reward.
+ * Pressure is one system-wide value, the same whatever a task did: its
+ * default weight keeps full pressure (1000) at the cost of 10 ms of wait,
+ * so it shades the per-task terms rather than drowning them out.
+ */
+static long rl_reward(const struct rl_obs *obs)
+{
+    long cpu_ms = (long)(obs->v[RL_DIM_CPU] / NSEC_PER_MSEC);
+    long wait_ms = (long)(obs->v[RL_DIM_WAIT] / NSEC_PER_MSEC);
+
+    return ((long)READ_ONCE(reward_cpu_permille) * cpu_ms -
+            (long)READ_ONCE(reward_wait_permille) * wait_ms -
+            (long)READ_ONCE(reward_pressure_permille) * (long)READ_ONCE(sys_pressure)) / 1000;
+}
+
+/*
+ * Close a full pass over a shard: without PSI, refresh the system pressure
+ * estimate from the wait time of the latest complete pass of every shard.
+ */
+static void pass_complete(struct rl_shard *sh)
+{
+    u64 capacity = rl_interval_ns() * num_online_cpus();
+    u64 wait = 0, pr;
+    int cpu;
+
+    WRITE_ONCE(sh->last_pass_wait_ns, sh->pass_wait_ns);
+    sh->pass_wait_ns = 0;
+
+    if (percpu_workers) {
+        for_each_online_cpu(cpu)
+            wait += READ_ONCE(per_cpu_ptr(rl_shards, cpu)->last_pass_wait_ns);
+    } else {
+        wait = sh->last_pass_wait_ns;
+    }
+
+    if (!READ_ONCE(psi_unavailable))
+        return;
+    pr = capacity ? div64_u64(wait * 1000, capacity) : 0;
+    WRITE_ONCE(sys_pressure, (unsigned int)min_t(u64, pr, 1000));
+}
+
+/* "some avg10" of /proc/pressure/cpu in permille (it is a percentage) */
+static int psi_cpu_read(unsigned int *permille)
+{
+    struct file *f = filp_open("/proc/pressure/cpu", O_RDONLY, 0);
+    unsigned int whole, frac;
+    char buf[128] = {};
+    loff_t pos = 0;
+    ssize_t n;
+    char *s;
+
+    if (IS_ERR(f))
+        return PTR_ERR(f);
+    n = kernel_read(f, buf, sizeof(buf) - 1, &pos);
+    filp_close(f, NULL);
+    if (n < 0)
+        return n;
+    s = strstr(buf, "some avg10=");
+    if (!s || sscanf(s, "some avg10=%u.%2u", &whole, &frac) != 2)
+        return -EINVAL;
+    *permille = min(whole * 10 + frac / 10, 1000U);
+    return 0;
+}
+
+/* PSI recomputes its averages every 2 s (PSI_FREQ) */
+#define RL_PSI_PERIOD_NS (2 * NSEC_PER_SEC)
+
+/*
+ * Refresh sys_pressure from PSI, at most once per tick period or PSI
+ * update, whichever is longer, across all workers; in between the last
+ * value stands. If the kernel has no PSI (not built in, or psi=0), fall
+ * back to the pass estimate for good.
+ */
+static void rl_psi_tick(void)
+{
+    u64 now = ktime_get_ns(), next = atomic64_read(&psi_next_ns);
+    unsigned int pr;
+    int err;
+
+    if (READ_ONCE(psi_unavailable) || now < next ||
+        atomic64_cmpxchg(&psi_next_ns, next,
+                         now + max_t(u64, rl_interval_ns(), RL_PSI_PERIOD_NS)) != next)
+        return;
+    err = psi_cpu_read(&pr);
+    if (err == -ENOENT || err == -EOPNOTSUPP) {
+        WRITE_ONCE(psi_unavailable, true);
+        pr_info("rl_sched_mod: no PSI, estimating CPU pressure from tracked tasks\n");
+    } else if (!err) {
+        WRITE_ONCE(sys_pressure, pr);
+    }
+}
+
+/*
+ * Group agents (group_mode). Under autogroup or cgroup v2 CPU control a
+ * task's nice only competes within its group, so one agent per group
+ * learns on the summed observations of its members and moves the group's
+ * own knob: cpu.weight of the cgroup, or the autogroup nice. Members are
+ * still sampled by the scan, which adds each observation to its group;
+ * the group steps once per tick period. Group agents use a store slot
+ * like tasks do and trace as pid 0.
+ */
+struct rl_group {
+    struct pid_entry agent;        /* Q-table and store slot */
+    u64 key;                       /* cgroup id, or autogroup address */
+    struct rhash_head node;
+    pid_t member;                  /* a recently seen member */
+    unsigned int idle;             /* steps without member observations */
+    char *path;                    /* full cgroup path, for cpu.weight */
+    bool has_orig;                 /* orig is set (autogroup; cgroups */
+    long orig;                     /* keep theirs in cgweight_table) */
+    atomic64_t acc[RL_NR_DIMS];    /* member observations since last step */
+    atomic_t nr_acc;
+    struct rcu_head rcu;
+};
+
+/* steps without any member seen before a group agent is dropped */
+#define RL_GROUP_IDLE_STEPS 16
+
+static struct rhashtable group_table;
+
+static const struct rhashtable_params group_table_params = {
+    .key_len     = sizeof(u64),
+    .key_offset  = offsetof(struct rl_group, key),
+    .head_offset = offsetof(struct rl_group, node),
+};
+
+/* group steps run in one worker at a time; only they free groups */
+static DEFINE_MUTEX(group_mutex);
+static atomic64_t next_group_ns;
+
+/* group key of p; false if p is in no group with a knob (caller holds RCU) */
+static bool group_key(struct task_struct *p, u64 *key)
+{
+    switch (group_mode) {
+#ifdef CONFIG_CGROUPS
+    case RL_GROUP_CGROUP: {
+        struct cgroup *cgrp = task_dfl_cgroup(p);
+
+        if (!cgroup_parent(cgrp))
+            return false; /* the root has no cpu.weight */
+        *key = cgroup_id(cgrp);
+        return true;
+    }
+#endif
+#ifdef CONFIG_SCHED_AUTOGROUP
+    case RL_GROUP_AUTOGROUP:
+        *key = (unsigned long)READ_ONCE(p->signal->autogroup);
+        return true;
+#endif
+    }
+    return false;
+}
+
+/* find or create p's group agent; never sleeps (caller holds RCU) */
+static struct rl_group *group_for_task(struct task_struct *p)
+{
+    struct rl_group *g, *old;
+    u64 key;
+
+    if (!group_key(p, &key))
+        return NULL;
+    g = rhashtable_lookup_fast(&group_table, &key, group_table_params);
+    if (g)
+        return g;
+
+    if (atomic_read(&group_table.nelems) >= max_policies)
+        return NULL;
+    g = kzalloc(sizeof(*g), GFP_NOWAIT | __GFP_NOWARN);
+    if (!g)
+        return NULL;
+    if (store_alloc_idx(&g->agent.idx)) {
+        kfree(g);
+        return NULL;
+    }
+    g->key = key;
+    g->member = p->pid;
+#ifdef CONFIG_CGROUPS
+    if (group_mode == RL_GROUP_CGROUP) {
+        /* deep paths must not be cut short, or we write the wrong file */
+        char *buf = kmalloc(PATH_MAX, GFP_NOWAIT | __GFP_NOWARN);
+
+        if (buf && cgroup_path(task_dfl_cgroup(p), buf, PATH_MAX) > 0)
+            g->path = kstrdup(buf, GFP_NOWAIT | __GFP_NOWARN);
+        kfree(buf);
+        if (!g->path) {
+            store_free_idx(g->agent.idx);
+            kfree(g);
+            return NULL;
+        }
+    }
+#endif
+
+    old = rhashtable_lookup_get_insert_fast(&group_table, &g->node,
+                                            group_table_params);
+    if (old) {
+        store_free_idx(g->agent.idx);
+        kfree(g->path);
+        kfree(g);
+        return IS_ERR(old) ? NULL : old;
+    }
+    return g;
+}
+
+/* add one member observation to p's group (caller holds RCU) */
+static void group_account(struct task_struct *p, const struct rl_obs *obs)
+{
+    struct rl_group *g = group_for_task(p);
+    int i;
+
+    if (!g)
+        return;
+    for (i = 0; i < RL_NR_DIMS; i++)
+        atomic64_add(obs->v[i], &g->acc[i]);
+    atomic_inc(&g->nr_acc);
+    WRITE_ONCE(g->member, p->pid);
+}
+
+#ifdef CONFIG_SCHED_AUTOGROUP
+/*
+ * The member the group's autogroup is reached through, if it is still in
+ * it. member is only the last pid seen and may have exited or moved, and
+ * the key (the autogroup's address) may belong to a new autogroup once
+ * the old one is freed; either way /proc/<member>/autogroup is not ours.
+ */
+static pid_t autogroup_member(struct rl_group *g)
+{
+    pid_t pid = READ_ONCE(g->member);
+    struct task_struct *p;
+    bool ok;
+
+    rcu_read_lock();
+    p = pid_task(find_pid_ns(pid, &init_pid_ns), PIDTYPE_PID);
+    ok = p && !(p->flags & PF_EXITING) &&
+         (unsigned long)READ_ONCE(p->signal->autogroup) == g->key;
+    rcu_read_unlock();
+    return ok ? pid : 0;
+}
+
+/* autogroup nice, through /proc/<pid>/autogroup ("/autogroup-N nice X") */
+static int autogroup_nice_get(pid_t pid, long *val)
+{
+    char path[32], buf[64] = {};
+    struct file *f;
+    loff_t pos = 0;
+    ssize_t n;
+    char *s;
+
+    snprintf(path, sizeof(path), "/proc/%d/autogroup", pid);
+    f = filp_open(path, O_RDONLY, 0);
+    if (IS_ERR(f))
+        return PTR_ERR(f);
+    n = kernel_read(f, buf, sizeof(buf) - 1, &pos);
+    filp_close(f, NULL);
+    if (n < 0)
+        return n;
+    s = strstr(buf, "nice ");
+    if (!s)
+        return -EINVAL;
+    return kstrtol(strim(s + 5), 10, val);
+}
+
+static int autogroup_nice_set(pid_t pid, long val)
+{
+    char path[32], buf[16];
+    struct file *f;
+    loff_t pos = 0;
+    ssize_t n;
+    int len;
+
+    snprintf(path, sizeof(path), "/proc/%d/autogroup", pid);
+    f = filp_open(path, O_WRONLY, 0);
+    if (IS_ERR(f))
+        return PTR_ERR(f);
+    len = scnprintf(buf, sizeof(buf), "%ld\n", val);
+    n = kernel_write(f, buf, len, &pos);
+    filp_close(f, NULL);
+    return n < 0 ? n : 0;
+}
+#endif
+
+/* the group's knob: cpu.weight of the cgroup, or the autogroup nice */
+static int group_knob_get(struct rl_group *g, long *val)
+{
+    switch (group_mode) {
+#ifdef CONFIG_CGROUPS
+    case RL_GROUP_CGROUP:
+        return cgroup_weight_get(g->path, val);
+#endif
+#ifdef CONFIG_SCHED_AUTOGROUP
+    case RL_GROUP_AUTOGROUP: {
+        pid_t pid = autogroup_member(g);
+
+        return pid ? autogroup_nice_get(pid, val) : -ESRCH;
+    }
+#endif
+    }
+    return -EOPNOTSUPP;
+}
+
+static int group_knob_set(struct rl_group *g, long val)
+{
+    switch (group_mode) {
+#ifdef CONFIG_CGROUPS
+    case RL_GROUP_CGROUP:
+        return cgroup_weight_set(g->path, val);
+#endif
+#ifdef CONFIG_SCHED_AUTOGROUP
+    case RL_GROUP_AUTOGROUP: {
+        pid_t pid = autogroup_member(g);
+
+        return pid ? autogroup_nice_set(pid, val) : -ESRCH;
+    }
+#endif
+    }
+    return -EOPNOTSUPP;
+}
+
+static long group_knob_next(long cur, int action)
+{
+#ifdef CONFIG_CGROUPS
+    if (group_mode == RL_GROUP_CGROUP)
+        return weight_next(cur, action);
+#endif
+    return nice_next(cur, action);
+}
+
+static void group_error(int err)
+{
+    if (err != -ENOENT && err != -ESRCH)
+        atomic_long_inc(&actuate_errors);
+}
+
+/*
+ * Move the group's knob for action; caller holds group_mutex, may sleep.
+ * Returns true if the knob moved, or with dry_run would have moved.
+ */
+static bool group_actuate(struct rl_group *g, int action)
+{
+    bool dry = READ_ONCE(dry_run);
+    long cur, val;
+    int err;
+
+    err = group_knob_get(g, &cur);
+    if (err) {
+        group_error(err);
+        return false;
+    }
+    val = group_knob_next(cur, action);
+    if (val == cur)
+        return false;
+    trace_rl_group_actuate(g->key, group_mode, action, cur, val, dry);
+    if (unlikely(READ_ONCE(debug)))
+        pr_info("rl_sched_mod: group %llx (%s) action=%d: %ld -> %ld%s\n",
+                g->key, g->path ?: "", action, cur, val, dry ? " (dry run)" : "");
+    if (dry)
+        return true;
+#ifdef CONFIG_CGROUPS
+    if (group_mode == RL_GROUP_CGROUP)
+        cgweight_save(g->key, g->path, cur);
+    else
+#endif
+    if (!g->has_orig) {
+        g->orig = cur;
+        g->has_orig = true;
+    }
+    err = group_knob_set(g, val);
+    if (err)
+        group_error(err);
+    return true;
+}
+
+/* put the group's knob back as it was; caller holds group_mutex, may sleep */
+static void group_restore(struct rl_group *g)
+{
+    long cur;
+    int err;
+
+#ifdef CONFIG_CGROUPS
+    if (group_mode == RL_GROUP_CGROUP) {
+        cgweight_restore(g->key);
+        return;
+    }
+#endif
+    if (!g->has_orig)
+        return;
+    err = group_knob_get(g, &cur);
+    if (!err && cur != g->orig)
+        err = group_knob_set(g, g->orig);
+    if (err)
+        group_error(err);
+}
+
+static void group_free_rcu(struct rcu_head *head)
+{
+    struct rl_group *g = container_of(head, struct rl_group, rcu);
+
+    store_free_idx(g->agent.idx);
+    kfree(g->path);
+    kfree(g);
+}
+
+/*
+ * One learning step of a group agent on what its members were observed
+ * doing since the previous step. Caller holds group_mutex; may sleep.
+ */
+static void group_step(struct rl_shard *sh, struct rl_group *g)
+{
+    struct pid_entry *pe = &g->agent;
+    u32 idx = pe->idx;
+    struct rl_obs obs;
+    int i, st, action;
+    bool off_policy;
+    long reward;
+    u64 now;
+
+    if (!atomic_xchg(&g->nr_acc, 0)) {
+        if (++g->idle > RL_GROUP_IDLE_STEPS &&
+            rhashtable_remove_fast(&group_table, &g->node,
+                                   group_table_params) == 0) {
+            group_restore(g);
+            call_rcu(&g->rcu, group_free_rcu);
+        }
+        return;
+    }
+    g->idle = 0;
+
+    for (i = 0; i < RL_NR_DIMS; i++)
+        obs.v[i] = atomic64_xchg(&g->acc[i], 0);
+    st = obs_to_state(&obs);
+    reward = rl_reward(&obs);
+    trace_rl_observe(0, st, obs.v[RL_DIM_CPU], obs.v[RL_DIM_WAIT],
+                     obs.v[RL_DIM_VCSW], obs.v[RL_DIM_IVCSW],
+                     obs.v[RL_DIM_UTIL], reward);
+
+    action = choose_action(pe, st, &off_policy);
+    now = ktime_get_ns();
+    /* the same churn limits as task agents, on the embedded entry */
+    if (action != RL_NOOP && !action_allowed(sh, pe, action, now, 0)) {
+        action = RL_NOOP;
+        off_policy = true;
+    }
+    if (rl_store.prev_stamp[idx] && READ_ONCE(rl_mode) == RL_MODE_LEARN) {
+        atomic64_add(q_update(pe, rl_store.prev_state[idx],
+                              rl_store.prev_action[idx], reward, st, action,
+                              off_policy),
+                     &tick_qdelta_sum);
+        atomic_inc(&tick_q_updates);
+    }
+    rl_store.visits[(size_t)idx * num_states + st]++;
+    rl_store.prev_state[idx] = st;
+    rl_store.prev_action[idx] = action;
+    rl_store.prev_stamp[idx] = now;
+
+    if (action != RL_NOOP && group_actuate(g, action)) {
+        pe->last_change_ns = now;
+        sh->stats.knob_changes++;
+    }
+}
+
+/* step every group agent, at most once per tick period across workers */
+static void rl_group_tick(struct rl_shard *sh)
+{
+    u64 now = ktime_get_ns();
+    s64 next = atomic64_read(&next_group_ns);
+    struct rhashtable_iter iter;
+    struct rl_group *g;
+
+    if (READ_ONCE(rl_mode) == RL_MODE_PAUSE)
+        return;
+    if ((s64)now < next ||
+        atomic64_cmpxchg(&next_group_ns, next,
+                         now + READ_ONCE(effective_interval_ns) / 2) != next)
+        return;
+    if (!mutex_trylock(&group_mutex))
+        return;
+
+    rhashtable_walk_enter(&group_table, &iter);
+    rhashtable_walk_start(&iter);
+    while ((g = rhashtable_walk_next(&iter))) {
+        if (IS_ERR(g)) {
+            if (PTR_ERR(g) == -EAGAIN)
+                continue;
+            break;
+        }
+        /* g stays valid outside RCU: only group steps free groups */
+        rhashtable_walk_stop(&iter);
+        group_step(sh, g);
+        cond_resched();
+        rhashtable_walk_start(&iter);
+    }
+    rhashtable_walk_stop(&iter);
+    rhashtable_walk_exit(&iter);
+    mutex_unlock(&group_mutex);
+}
+
+/*
+ * Snapshot phase for one task (caller holds rcu_read_lock): copy what the
+ * compute phase needs and take a reference for the actuation phase.
+ * Idle tasks, and all tasks in pause mode, are left out of the batch.
+ */
+static void rl_snapshot(struct rl_shard *sh, struct pid_entry *pe,
+                        struct task_struct *p, u64 now)
+{
+    struct rl_batch *b = sh->batch;
+    struct rl_snap *sn = &b->snap[b->n];
+    u32 idx = pe->idx;
+
+    if (READ_ONCE(rl_mode) == RL_MODE_PAUSE)
+        return;
+    task_sample(p, &sn->smp);
+
+    /*
+     * Idle fast path: no CPU time since the last visit and not queued
+     * now (a task starved on a runqueue is not idle), so there is
+     * nothing to learn or change. The baselines move up to now, so the
+     * next active visit measures its burst over the time since the last
+     * skip, not over the whole sleep; runtime has not moved.
+     */
+    if (READ_ONCE(skip_idle) && rl_store.prev_runtime[idx] &&
+        sn->smp.runtime == rl_store.prev_runtime[idx] && !sn->smp.nr_queued) {
+        static const struct rl_obs idle_obs;
+
+        /* a sleeping member still belongs to its group, which is not empty */
+        if (group_mode != RL_GROUP_NONE)
+            group_account(p, &idle_obs);
+        rl_store.prev_run_delay[idx] = sn->smp.run_delay;
+        rl_store.prev_nvcsw[idx] = (u32)sn->smp.nvcsw;
+        rl_store.prev_nivcsw[idx] = (u32)sn->smp.nivcsw;
+        rl_store.prev_stamp[idx] = now;
+        sh->stats.skipped_idle++;
+        return;
+    }
+
+    sn->pe = pe;
+    sn->task = p;
+    get_task_struct(p);
+    sn->stamp = now;
+    sn->cpu = task_cpu(p);
+    sn->cgrp = 0;
+#ifdef CONFIG_CGROUPS
+    if (actuator == RL_ACT_WEIGHT)
+        sn->cgrp = cgroup_id(task_dfl_cgroup(p));
+#endif
+    sn->action = RL_NO_ACTION;
+    b->n++;
+}
+
+/*
+ * A dead entry whose task lives on was dropped by a filter (at exec or
+ * after a rule change): queue its knob to be put back. Caller holds
+ * rcu_read_lock; the entry is freed before the batch is actuated.
+ */
+static void rl_snapshot_restore(struct rl_shard *sh, struct pid_entry *pe)
+{
+    struct rl_batch *b = sh->batch;
+    struct rl_snap *sn = &b->snap[b->n];
+    struct task_struct *p;
+
+    if (!smp_load_acquire(&pe->has_orig))
+        return;
+    p = pid_task(find_pid_ns(pe->pid, &init_pid_ns), PIDTYPE_PID);
+    if (!p || (p->flags & PF_EXITING))
+        return;
+    /* a newer entry for the task (after exec) took over the original */
+    if (rhashtable_lookup_fast(&pid_table, &pe->pid, pid_table_params))
+        return;
+
+    sn->pe = NULL;
+    sn->task = p;
+    get_task_struct(p);
+    sn->cpu = task_cpu(p);
+    sn->action = RL_RESTORE;
+    sn->restore_val = pe->orig_val;
+    b->n++;
+}
+
+/*
+ * Compute phase for one task: one learning step on its snapshot. Runs
+ * outside RCU; the entry stays valid as only its owner frees it, and the
+ * task is referenced.
+ */
+static void rl_step(struct rl_shard *sh, struct rl_snap *sn)
+{
+    struct rl_batch *b = sh->batch;
+    const struct rl_sample *cur = &sn->smp;
+    struct pid_entry *pe = sn->pe;
+    u32 idx = pe->idx;
+    struct rl_obs obs;
+    bool off_policy;
+    u64 elapsed;
+    int st;
+    long reward;
+
+    if (rl_store.prev_runtime[idx] == 0)
+        goto save;
+
+    elapsed = sn->stamp - rl_store.prev_stamp[idx];
+    obs.v[RL_DIM_CPU] = interval_delta(cur->runtime, rl_store.prev_runtime[idx], elapsed);
+    obs.v[RL_DIM_WAIT] = interval_delta(cur->run_delay, rl_store.prev_run_delay[idx], elapsed);
+    obs.v[RL_DIM_VCSW] = scale_delta((u32)((u32)cur->nvcsw - rl_store.prev_nvcsw[idx]), elapsed);
+    obs.v[RL_DIM_IVCSW] = scale_delta((u32)((u32)cur->nivcsw - rl_store.prev_nivcsw[idx]), elapsed);
+    obs.v[RL_DIM_UTIL] = cur->util;
+    st = obs_to_state(&obs);
+    reward = rl_reward(&obs);
+    trace_rl_observe(pe->pid, st, obs.v[RL_DIM_CPU], obs.v[RL_DIM_WAIT],
+                     obs.v[RL_DIM_VCSW], obs.v[RL_DIM_IVCSW],
+                     obs.v[RL_DIM_UTIL], reward);
+    sh->pass_wait_ns += obs.v[RL_DIM_WAIT];
+
+    if (group_mode != RL_GROUP_NONE) {
+        /* the group table and the task's cgroup are RCU-protected */
+        rcu_read_lock();
+        group_account(sn->task, &obs);
+        rcu_read_unlock();
+        if (!group_task_agents)
+            goto save;
+    }
+
+    sn->action = choose_action(pe, st, &off_policy);
+    /* churn limits before learning, so SARSA bootstraps on what is taken */
+    if (sn->action != RL_NOOP &&
+        !action_allowed(sh, pe, sn->action, sn->stamp, sn->cgrp)) {
+        sn->action = RL_NOOP;
+        off_policy = true;
+    }
+    if (READ_ONCE(rl_mode) == RL_MODE_LEARN) {
+        b->qdelta += q_update(pe, rl_store.prev_state[idx],
+                              rl_store.prev_action[idx], reward, st,
+                              sn->action, off_policy);
+        b->q_updates++;
+    }
+    rl_store.visits[(size_t)idx * num_states + st]++;
+    sh->stats.actions[sn->action]++;
+
+    rl_store.prev_state[idx] = st;
+    rl_store.prev_action[idx] = sn->action;
+save:
+    rl_store.prev_runtime[idx] = cur->runtime;
+    rl_store.prev_run_delay[idx] = cur->run_delay;
+    rl_store.prev_nvcsw[idx] = (u32)cur->nvcsw;
+    rl_store.prev_nivcsw[idx] = (u32)cur->nivcsw;
+    rl_store.prev_stamp[idx] = sn->stamp;
+}
+
+/* compute phase of a batch; no locks held */
+static void rl_compute(struct rl_shard *sh)
+{
+    struct rl_batch *b = sh->batch;
+    unsigned int i;
+
+    b->qdelta = 0;
+    b->q_updates = 0;
+    for (i = 0; i < b->n; i++)
+        if (b->snap[i].action != RL_RESTORE)
+            rl_step(sh, &b->snap[i]);
+    if (b->q_updates) {
+        atomic64_add(b->qdelta, &tick_qdelta_sum);
+        atomic_add(b->q_updates, &tick_q_updates);
+    }
+}
+
+/*
+ * Put every knob the agents changed back to its value from before the
+ * first change: of all tracked tasks, of all group agents, and of every
+ * cgroup whose cpu.weight was moved. For the
+ * sysfs reset and for unload; may sleep. Workers that are still running
+ * may change knobs again right after (set mode to pause first).
+ */
+static void restore_all(void)
+{
+    struct rhashtable_iter iter;
+    struct pid_entry *pe;
+    struct rl_group *g;
+
+    rhashtable_walk_enter(&pid_table, &iter);
+    rhashtable_walk_start(&iter);
+    while ((pe = rhashtable_walk_next(&iter))) {
+        struct task_struct *p;
+        long val;
+
+        if (IS_ERR(pe)) {
+            if (PTR_ERR(pe) == -EAGAIN)
+                continue;
+            break;
+        }
+        if (!smp_load_acquire(&pe->has_orig))
+            continue;
+        val = pe->orig_val;
+        p = pid_task(find_pid_ns(pe->pid, &init_pid_ns), PIDTYPE_PID);
+        if (!p || (p->flags & PF_EXITING))
+            continue;
+        get_task_struct(p);
+        rhashtable_walk_stop(&iter);
+        restore_knob(p, val);
+        put_task_struct(p);
+        cond_resched();
+        rhashtable_walk_start(&iter);
+    }
+    rhashtable_walk_stop(&iter);
+    rhashtable_walk_exit(&iter);
+
+    mutex_lock(&group_mutex);
+    rhashtable_walk_enter(&group_table, &iter);
+    rhashtable_walk_start(&iter);
+    while ((g = rhashtable_walk_next(&iter))) {
+        if (IS_ERR(g)) {
+            if (PTR_ERR(g) == -EAGAIN)
+                continue;
+            break;
+        }
+        /* g stays valid outside RCU: group steps are held off */
+        rhashtable_walk_stop(&iter);
+        group_restore(g);
+        cond_resched();
+        rhashtable_walk_start(&iter);
+    }
+    rhashtable_walk_stop(&iter);
+    rhashtable_walk_exit(&iter);
+    mutex_unlock(&group_mutex);
+
+#ifdef CONFIG_CGROUPS
+    cgweight_restore(0);
+    cgclaim_free_all();
+#endif
+}
+
+/* look up the task behind an entry, dropping entries whose task is gone */
+static struct task_struct *entry_task(struct pid_entry *pe)
+{
+    struct task_struct *p;
+
+    p = pid_task(find_pid_ns(pe->pid, &init_pid_ns), PIDTYPE_PID);
+    if (!p) {
+        /* exit raced with seeding; drop the leftover */
+        kill_pid_entry(pe);
+        return NULL;
+    }
+    if (p->exit_state)
+        return NULL;
+    return p;
+}
+
+/* move entries handed to this shard onto its list (owner only) */
+static void shard_drain_inbox(struct rl_shard *sh)
+{
+    struct llist_node *n = llist_reverse_order(llist_del_all(&sh->inbox));
+    struct pid_entry *e, *tmp;
+
+    llist_for_each_entry_safe(e, tmp, n, handoff) {
+        list_add_tail(&e->shard_node, &sh->entries);
+        sh->nr++;
+    }
+}
+
+/* free a dead entry once RCU readers are done with it (owner only) */
+static void shard_free_entry(struct rl_shard *sh, struct pid_entry *e)
+{
+    list_del(&e->shard_node);
+    sh->nr--;
+    call_rcu(&e->rcu, pid_entry_free_rcu);
+}
+
+/* pass all entries of a shard going offline to another shard */
+static void shard_move_all(struct rl_shard *sh, struct rl_shard *to)
+{
+    struct pid_entry *e, *tmp;
+
+    shard_drain_inbox(sh);
+    list_for_each_entry_safe(e, tmp, &sh->entries, shard_node) {
+        list_del(&e->shard_node);
+        shard_handoff(to, e);
+    }
+    sh->nr = 0;
+    sh->pass_left = 0;
+}
+
+/*
+ * One tick of scanning a shard. The pass over its entries is split into
+ * batches of scan_batch tasks; each batch is snapshotted in its own RCU
+ * read-side section, then computed and actuated outside it, with a
+ * cond_resched() before the next batch. When scan_max_tasks or
+ * scan_budget_us is hit, the rest of the pass is left at the head of the
+ * list and the next tick resumes there. A tick never starts a second pass
+ * over the shard. With percpu_workers, tasks found on another CPU move to
+ * that CPU's shard once their batch is done.
+ */
+static void rl_scan_tick(struct rl_shard *sh)
+{
+    unsigned int visited = 0, batch;
+    u64 start, deadline, now, t0, t1, t2, tick_us;
+    bool limit_hit = false;
+    struct pid_entry *pe, *tmp;
+    LIST_HEAD(moving);
+
+    shard_drain_inbox(sh);
+    if (!sh->pass_left)
+        sh->pass_left = sh->nr;
+    sh->tick_changes = 0;
+
+    start = ktime_get_ns();
+    deadline = scan_budget_us ? start + (u64)scan_budget_us * NSEC_PER_USEC : 0;
+
+    while (sh->pass_left && !limit_hit) {
+        batch = clamp_t(unsigned int, READ_ONCE(scan_batch), 1, RL_MAX_BATCH);
+
+        t0 = ktime_get_ns();
+        rcu_read_lock();
+        while (batch && sh->pass_left) {
+            struct task_struct *p;
+
+            pe = list_first_entry(&sh->entries, struct pid_entry, shard_node);
+            list_move_tail(&pe->shard_node, &sh->entries);
+            sh->pass_left--;
+
+            now = ktime_get_ns();
+            p = READ_ONCE(pe->dead) ? NULL : entry_task(pe);
+            if (p && !entry_managed(pe, p))
+                p = NULL;
+            if (p) {
+                rl_snapshot(sh, pe, p, now);
+                if (percpu_workers && task_cpu(p) != sh->cpu) {
+                    pe->handoff_cpu = task_cpu(p);
+                    list_move_tail(&pe->shard_node, &moving);
+                    sh->nr--;
+                }
+            } else if (READ_ONCE(pe->dead)) {
+                rl_snapshot_restore(sh, pe);
+                shard_free_entry(sh, pe);
+            }
+
+            batch--;
+            visited++;
+            if ((scan_max_tasks && visited >= scan_max_tasks) ||
+                (deadline && now >= deadline)) {
+                limit_hit = true;
+                break;
+            }
+        }
+        rcu_read_unlock();
+        t1 = ktime_get_ns();
+        rl_compute(sh);
+        t2 = ktime_get_ns();
+        actuate_batch(sh);
+        now = ktime_get_ns();
+        sh->stats.phase_ns[RL_PHASE_SNAPSHOT] += t1 - t0;
+        sh->stats.phase_ns[RL_PHASE_COMPUTE] += t2 - t1;
+        sh->stats.phase_ns[RL_PHASE_ACTUATE] += now - t2;
+
+        /* hand off only once the batch is done with the entries */
+        rcu_read_lock();
+        list_for_each_entry_safe(pe, tmp, &moving, shard_node) {
+            struct rl_shard *to = per_cpu_ptr(rl_shards, pe->handoff_cpu);
+
+            list_del(&pe->shard_node);
+            if (READ_ONCE(to->online)) {
+                shard_handoff(to, pe);
+            } else {
+                list_add_tail(&pe->shard_node, &sh->entries);
+                sh->nr++;
+            }
+        }
+        rcu_read_unlock();
+
+        if (kthread_should_stop())
+            break;
+        cond_resched();
+    }
+
+    if (!sh->pass_left)
+        pass_complete(sh);
+
+    tick_us = div_u64(ktime_get_ns() - start, NSEC_PER_USEC);
+    sh->stats.tick_hist[min_t(u64, tick_us ? ilog2(tick_us) + 1 : 0,
+                              RL_TICK_HIST - 1)]++;
+    sh->stats.scanned += visited;
+    sh->stats.ticks++;
+}
+
+/*
+ * Adaptive tick period. Halve it (down to interval_min_us) when CPU
+ * pressure, or per-CPU load beyond one runnable task per CPU, is above
+ * adapt_pressure_permille, or while
+ * Q-values still move by more than adapt_qdelta per update on average.
+ * Grow it by 25% (up to interval_max_us) once the system is quiet and the
+ * policy has converged. Without adaptive_interval the configured period
+ * is used as is.
+ */
+static void rl_adapt_interval(void)
+{
+    u64 now = ktime_get_ns();
+    s64 next = atomic64_read(&next_adapt_ns);
+    u64 period = READ_ONCE(effective_interval_ns);
+    u64 lo = (u64)max_t(unsigned int, READ_ONCE(interval_min_us),
+                        RL_MIN_INTERVAL_US) * NSEC_PER_USEC;
+    u64 hi = (u64)READ_ONCE(interval_max_us) * NSEC_PER_USEC;
+    unsigned int busy = READ_ONCE(adapt_pressure_permille);
+    unsigned long load;
+    u64 qdelta;
+    unsigned int updates;
+    bool hot, learning;
+
+    /* with several workers, the first to get here each period does it */
+    if ((s64)now < next ||
+        atomic64_cmpxchg(&next_adapt_ns, next, now + period / 2) != next)
+        return;
+
+    updates = atomic_xchg(&tick_q_updates, 0);
+    qdelta = atomic64_xchg(&tick_qdelta_sum, 0);
+    qdelta = updates ? div_u64(qdelta, updates) : 0;
+
+    if (!READ_ONCE(adaptive_interval)) {
+        WRITE_ONCE(effective_interval_ns, rl_interval_ns());
+        return;
+    }
+    if (hi < lo)
+        hi = lo;
+
+    /* 1-minute load average per online CPU, permille */
+    load = ((avenrun[0] * 1000) >> FSHIFT) / num_online_cpus();
+    hot = READ_ONCE(sys_pressure) > busy || load > busy + 1000;
+    learning = qdelta > READ_ONCE(adapt_qdelta);
+
+    if (hot || learning)
+        period >>= 1;
+    else
+        period += period >> 2;
+
+    WRITE_ONCE(effective_interval_ns, clamp(period, lo, hi));
+}
+
+/*
+ * Sleep until the next absolute tick deadline on an hrtimer. Deadlines
+ * advance by whole periods from the first tick, so the tick's own runtime
+ * does not make the schedule drift. Periods that were already over when
+ * the tick finished are skipped and counted as missed (missed_deadlines
+ * in the debugfs stats; at short intervals that is routine, so it is not
+ * logged).
+ */
+static void rl_wait_next_tick(ktime_t *deadline)
+{
+    u64 period = READ_ONCE(effective_interval_ns);
+    ktime_t now = ktime_get();
+
+    *deadline = ktime_add_ns(*deadline, period);
+    if (ktime_before(*deadline, now)) {
+        u64 late = ktime_to_ns(ktime_sub(now, *deadline));
+        u64 skip = div64_u64(late, period) + 1;
+
+        atomic_long_add(skip, &missed_deadlines);
+        *deadline = ktime_add_ns(*deadline, skip * period);
+    }
+
+    set_current_state(TASK_INTERRUPTIBLE);
+    if (!kthread_should_stop())
+        schedule_hrtimeout_range(deadline, 0, HRTIMER_MODE_ABS);
+    __set_current_state(TASK_RUNNING);
+}
+
+/*
+ * A resync (re-seed) is due when asked for, or once after the filters
+ * changed so newly allowed tasks get picked up.
+ */
+static bool resync_due(void)
+{
+    int gen = atomic_read(&filter_gen);
+    int seen = atomic_read(&seeded_filter_gen);
+    bool due = atomic_xchg(&resync_needed, 0);
+
+    if (gen != seen && atomic_cmpxchg(&seeded_filter_gen, seen, gen) == seen)
+        due = true;
+    return due;
+}
+
+/*
+ * RL worker: visits only the tasks of its shard, not the whole task list.
+ * The initial seed (resync_needed starts set) and later resyncs are done
+ * by whichever worker gets there first.
+ */
+static int rl_worker(void *arg)
+{
+    struct rl_shard *sh = arg;
+    ktime_t deadline = ktime_get();
+
+    while (!kthread_should_stop()) {
+        pool_refill();
+        if (resync_due())
+            seed_pid_table();
+        rl_psi_tick();
+
+        rl_scan_tick(sh);
+        rl_adapt_interval();
+        if (group_mode != RL_GROUP_NONE)
+            rl_group_tick(sh);
+
+        rl_wait_next_tick(&deadline);
+    }
+    return 0;
+}
+
+/* batches are too large for the shard itself (per-CPU memory is scarce) */
+static int shard_batch_alloc(struct rl_shard *sh, int node)
+{
+    sh->batch = kvmalloc_node(sizeof(*sh->batch), GFP_KERNEL, node);
+    if (!sh->batch)
+        return -ENOMEM;
+    sh->batch->n = 0;
+    return 0;
+}
+
+static void shard_batch_free(struct rl_shard *sh)
+{
+    kvfree(sh->batch);
+    sh->batch = NULL;
+}
+
+/* CPU hotplug: start a worker bound to a CPU coming online */
+static int rl_cpu_online(unsigned int cpu)
+{
+    struct rl_shard *sh = per_cpu_ptr(rl_shards, cpu);
+    struct task_struct *t;
+    int ret;
+
+    ret = shard_batch_alloc(sh, cpu_to_node(cpu));
+    if (ret)
+        return ret;
+    t = kthread_create(rl_worker, sh, "rl_sched/%u", cpu);
+    if (IS_ERR(t)) {
+        shard_batch_free(sh);
+        return PTR_ERR(t);
+    }
+    kthread_bind(t, cpu);
+    sh->thread = t;
+    WRITE_ONCE(sh->online, true);
+    wake_up_process(t);
+    return 0;
+}
+
+/* CPU hotplug: stop the CPU's worker and pass its tasks to another CPU */
+static int rl_cpu_offline(unsigned int cpu)
+{
+    struct rl_shard *sh = per_cpu_ptr(rl_shards, cpu);
+    unsigned int to;
+
+    /*
+     * Handoffs check online and push in one RCU read section: after the
+     * grace period nothing new can land in the inbox, so the drain in
+     * shard_move_all() below picks up every late arrival.
+     */
+    WRITE_ONCE(sh->online, false);
+    synchronize_rcu();
+    if (sh->thread) {
+        kthread_stop(sh->thread);
+        sh->thread = NULL;
+    }
+    shard_batch_free(sh);
+    to = cpumask_any_but(cpu_online_mask, cpu);
+    if (to < nr_cpu_ids)
+        shard_move_all(sh, per_cpu_ptr(rl_shards, to));
+    return 0;
+}
+
+static void shard_init(struct rl_shard *sh, int cpu)
+{
+    sh->cpu = cpu;
+    INIT_LIST_HEAD(&sh->entries);
+    init_llist_head(&sh->inbox);
+}
+
+static int rl_workers_start(void)
+{
+    struct rl_shard *sh = &rl_global_shard;
+    int ret;
+
+    if (percpu_workers) {
+        ret = cpuhp_setup_state(CPUHP_AP_ONLINE_DYN, "rl_sched:online",
+                                rl_cpu_online, rl_cpu_offline);
+        if (ret < 0)
+            return ret;
+        rl_cpuhp_state = ret;
+        return 0;
+    }
+
+    ret = shard_batch_alloc(sh, NUMA_NO_NODE);
+    if (ret)
+        return ret;
+    sh->thread = kthread_run(rl_worker, sh, "rl_sched_thread");
+    if (IS_ERR(sh->thread)) {
+        ret = PTR_ERR(sh->thread);
+        sh->thread = NULL;
+        shard_batch_free(sh);
+        return ret;
+    }
+    sh->online = true;
+    return 0;
+}
+
+static void rl_workers_stop(void)
+{
+    if (percpu_workers) {
+        if (rl_cpuhp_state > 0)
+            cpuhp_remove_state(rl_cpuhp_state);
+        rl_cpuhp_state = 0;
+    } else if (rl_global_shard.thread) {
+        kthread_stop(rl_global_shard.thread);
+        rl_global_shard.thread = NULL;
+        shard_batch_free(&rl_global_shard);
+    }
+}
+
+/* sysfs: /sys/kernel/rl_sched/ */
+static ssize_t effective_interval_us_show(struct kobject *kobj,
+                                          struct kobj_attribute *attr, char *buf)
+{
+    return sysfs_emit(buf, "%llu\n",
+                      div_u64(READ_ONCE(effective_interval_ns), NSEC_PER_USEC));
+}
+static struct kobj_attribute effective_interval_us_attr = __ATTR_RO(effective_interval_us);
+
+static ssize_t filter_show(struct kobject *kobj, struct kobj_attribute *attr,
+                           char *buf)
+{
+    return filter_emit(buf);
+}
+
+static ssize_t filter_store(struct kobject *kobj, struct kobj_attribute *attr,
+                            const char *buf, size_t count)
+{
+    int ret = filter_set(buf, count);
+
+    return ret ? ret : count;
+}
+static struct kobj_attribute filter_attr = __ATTR_RW_MODE(filter, 0600);
+
+/* the modes, the current one in brackets */
+static ssize_t mode_show(struct kobject *kobj, struct kobj_attribute *attr,
+                         char *buf)
+{
+    int cur = READ_ONCE(rl_mode), i, len = 0;
+
+    for (i = 0; i < RL_NR_MODES; i++)
+        len += sysfs_emit_at(buf, len, i == cur ? "%s[%s]" : "%s%s",
+                             i ? " " : "", rl_mode_names[i]);
+    len += sysfs_emit_at(buf, len, "\n");
+    return len;
+}
+
+static ssize_t mode_store(struct kobject *kobj, struct kobj_attribute *attr,
+                          const char *buf, size_t count)
+{
+    int mode = sysfs_match_string(rl_mode_names, buf);
+
+    if (mode < 0)
+        return mode;
+    if (xchg(&rl_mode, mode) != mode)
+        pr_info("rl_sched_mod: mode %s\n", rl_mode_names[mode]);
+    return count;
+}
+static struct kobj_attribute mode_attr = __ATTR_RW_MODE(mode, 0600);
+
+/* any write puts all changed knobs back to their original values */
+static ssize_t reset_store(struct kobject *kobj, struct kobj_attribute *attr,
+                           const char *buf, size_t count)
+{
+    restore_all();
+    return count;
+}
+static struct kobj_attribute reset_attr = __ATTR_WO(reset);
+
+static struct attribute *rl_attrs[] = {
+    &effective_interval_us_attr.attr,
+    &filter_attr.attr,
+    &mode_attr.attr,
+    &reset_attr.attr,
+    NULL,
+};
+
+static const struct attribute_group rl_attr_group = {
+    .attrs = rl_attrs,
+};
+
+static int rl_sysfs_init(void)
+{
+    int ret;
+
+    rl_kobj = kobject_create_and_add("rl_sched", kernel_kobj);
+    if (!rl_kobj)
+        return -ENOMEM;
+    ret = sysfs_create_group(rl_kobj, &rl_attr_group);
+    if (ret) {
+        kobject_put(rl_kobj);
+        rl_kobj = NULL;
+    }
+    return ret;
+}
+
+static void rl_sysfs_exit(void)
+{
+    if (rl_kobj) {
+        sysfs_remove_group(rl_kobj, &rl_attr_group);
+        kobject_put(rl_kobj);
+        rl_kobj = NULL;
+    }
+}
+
+/*
+ * Q-table dumps (native endianness, for reloads on the same kind of
+ * machine): a header, then nr_tables records of a name/id header and
+ * num_states x num_actions s32 permille Q-values. Records are keyed as
+ * policy_share keys the tables: by comm, by cgroup path (cgroup ids do
+ * not survive a reboot) or by executable inode and device. Without
+ * policy_share the most visited private table of each comm is saved under
+ * the comm and loads as a template for new tasks of that comm; tables
+ * that were never visited are left out. state_sig hashes the
+ * state thresholds, so a dump only loads into the same state space.
+ */
+#define RL_QDUMP_MAGIC   0x51544c52 /* "RLTQ" */
+#define RL_QDUMP_VERSION 1
+
+struct rl_qdump_hdr {
+    u32 magic;
+    u32 version;
+    u32 share;       /* policy_share the records are keyed by */
+    u32 num_states;
+    u32 num_actions;
+    u32 state_sig;
+    u32 nr_tables;
+    u32 reserved;
+};
+
+struct rl_qdump_rec {
+    char name[RL_POLICY_NAME_LEN]; /* comm or cgroup path */
+    u64 id;                        /* exe: inode number */
+    u64 dev;                       /* exe: device */
+    s32 q[];                       /* num_states x num_actions */
+};
+
+static DEFINE_MUTEX(qdump_mutex); /* serializes loads and their generation */
+static u32 qdump_gen;
+
+static u32 state_sig(void)
+{
+    u32 h = 0;
+    int i;
+
+    for (i = 0; i < RL_NR_DIMS; i++) {
+        h = jhash_1word(*rl_dims[i].nr, h);
+        h = jhash(rl_dims[i].thresh, *rl_dims[i].nr * sizeof(unsigned int), h);
+    }
+    return h;
+}
+
+static size_t qdump_rec_len(void)
+{
+    struct rl_qdump_rec *rec;
+
+    return struct_size(rec, q, num_states * NUM_ACTIONS);
+}
+
+/* largest dump this configuration can produce or accept */
+static size_t qdump_max_len(void)
+{
+    return sizeof(struct rl_qdump_hdr) +
+           ((size_t)max_policies + max_entries) * qdump_rec_len();
+}
+
+/* objects copied per RCU section while walking a table for a dump */
+#define QDUMP_WALK_BATCH 64
+
+static void *qdump_rec(void *buf, u32 i)
+{
+    return buf + sizeof(struct rl_qdump_hdr) + i * qdump_rec_len();
+}
+
+/* a private table in a dump being built, see qdump_pick_best() */
+struct rl_qdump_pick {
+    const char *name;
+    u64 visits;
+    u32 rec;
+};
+
+/* by comm, most visited first */
+static int qdump_pick_cmp(const void *a, const void *b)
+{
+    const struct rl_qdump_pick *x = a, *y = b;
+    int c = strcmp(x->name, y->name);
+
+    if (c)
+        return c;
+    if (x->visits != y->visits)
+        return x->visits > y->visits ? -1 : 1;
+    return 0;
+}
+
+static int qdump_pick_rec_cmp(const void *a, const void *b)
+{
+    const struct rl_qdump_pick *x = a, *y = b;
+
+    return x->rec < y->rec ? -1 : x->rec > y->rec;
+}
+
+/*
+ * Keep only the most visited of the first nr records of buf per comm,
+ * moved to the front in their original order; returns how many are left.
+ */
+static u32 qdump_pick_best(void *buf, struct rl_qdump_pick *picks, u32 nr)
+{
+    u32 i, k = 0;
+
+    sort(picks, nr, sizeof(*picks), qdump_pick_cmp, NULL);
+    for (i = 0; i < nr; i++)
+        if (!k || strcmp(picks[i].name, picks[k - 1].name))
+            picks[k++] = picks[i];
+
+    sort(picks, k, sizeof(*picks), qdump_pick_rec_cmp, NULL);
+    for (i = 0; i < k; i++)
+        if (picks[i].rec != i)
+            memcpy(qdump_rec(buf, i), qdump_rec(buf, picks[i].rec),
+                   qdump_rec_len());
+    return k;
+}
+
+/* snapshot all learned tables into a vmalloc'ed dump; may sleep */
+static void *qdump_build(size_t *len)
+{
+    unsigned int nq = num_states * NUM_ACTIONS;
+    size_t cap = atomic_read(&policy_table.nelems) + 64;
+    struct rl_qdump_hdr *hdr;
+    struct rhashtable_iter iter;
+    struct rl_policy *pol;
+    u32 nr = 0, n = 0;
+    void *buf;
+    unsigned int i;
+
+    if (policy_share == RL_SHARE_NONE)
+        cap += atomic_read(&pid_table.nelems);
+    buf = vzalloc(sizeof(*hdr) + cap * qdump_rec_len());
+    if (!buf)
+        return NULL;
+
+    if (policy_share == RL_SHARE_NONE) {
+        struct rl_qdump_pick *picks;
+        struct pid_entry *pe;
+
+        picks = kvmalloc_array(cap, sizeof(*picks), GFP_KERNEL);
+        if (!picks) {
+            vfree(buf);
+            return NULL;
+        }
+
+        rhashtable_walk_enter(&pid_table, &iter);
+        rhashtable_walk_start(&iter);
+        while (nr < cap && (pe = rhashtable_walk_next(&iter))) {
+            struct rl_qdump_rec *rec = qdump_rec(buf, nr);
+            struct task_struct *p;
+            const s32 *row;
+            u64 visits = 0;
+
+            if (IS_ERR(pe)) {
+                if (PTR_ERR(pe) == -EAGAIN)
+                    continue;
+                break;
+            }
+            p = pid_task(find_pid_ns(pe->pid, &init_pid_ns), PIDTYPE_PID);
+            if (!p)
+                continue;
+            for (i = 0; i < num_states; i++)
+                visits += rl_store.visits[(size_t)pe->idx * num_states + i];
+            if (!visits)
+                continue;
+            strscpy_pad(rec->name, p->comm, sizeof(rec->name));
+            row = q_row(pe->idx);
+            for (i = 0; i < nq; i++)
+                rec->q[i] = q_row_val(row, i);
+            picks[nr].name = rec->name;
+            picks[nr].visits = visits;
+            picks[nr].rec = nr;
+            nr++;
+            if (++n % QDUMP_WALK_BATCH == 0) {
+                rhashtable_walk_stop(&iter);
+                cond_resched();
+                rhashtable_walk_start(&iter);
+            }
+        }
+        rhashtable_walk_stop(&iter);
+        rhashtable_walk_exit(&iter);
+
+        nr = qdump_pick_best(buf, picks, nr);
+        kvfree(picks);
+    }
+
+    rhashtable_walk_enter(&policy_table, &iter);
+    rhashtable_walk_start(&iter);
+    while (nr < cap && (pol = rhashtable_walk_next(&iter))) {
+        struct rl_qdump_rec *rec = qdump_rec(buf, nr);
+
+        if (IS_ERR(pol)) {
+            if (PTR_ERR(pol) == -EAGAIN)
+                continue;
+            break;
+        }
+        strscpy_pad(rec->name, pol->name, sizeof(rec->name));
+        if (policy_share == RL_SHARE_EXE) {
+            rec->id = pol->key.id;
+            rec->dev = pol->key.dev;
+        }
+        for (i = 0; i < nq; i++)
+            rec->q[i] = q_pol_val(pol, i);
+        nr++;
+        if (++n % QDUMP_WALK_BATCH == 0) {
+            rhashtable_walk_stop(&iter);
+            cond_resched();
+            rhashtable_walk_start(&iter);
+        }
+    }
+    rhashtable_walk_stop(&iter);
+    rhashtable_walk_exit(&iter);
+
+    hdr = buf;
+    hdr->magic = RL_QDUMP_MAGIC;
+    hdr->version = RL_QDUMP_VERSION;
+    hdr->share = policy_share;
+    hdr->num_states = num_states;
+    hdr->num_actions = NUM_ACTIONS;
+    hdr->state_sig = state_sig();
+    hdr->nr_tables = nr;
+    *len = sizeof(*hdr) + nr * qdump_rec_len();
+    return buf;
+}
+
+/* policy key a dump record stands for under the current policy_share */
+static int qdump_rec_key(const struct rl_qdump_rec *rec, struct rl_policy_key *key)
+{
+    /* the dump comes from user space: its names may be unterminated */
+    if (rec->name[RL_POLICY_NAME_LEN - 1] != '\0')
+        return -EINVAL;
+    memset(key, 0, sizeof(*key));
+    switch (policy_share) {
+    case RL_SHARE_NONE:
+    case RL_SHARE_COMM:
+        strscpy_pad(key->comm, rec->name, sizeof(key->comm));
+        return 0;
+    case RL_SHARE_CGROUP:
+#ifdef CONFIG_CGROUPS
+    {
+        struct cgroup *cgrp = cgroup_get_from_path(rec->name);
+
+        if (IS_ERR(cgrp))
+            return PTR_ERR(cgrp);
+        key->id = cgroup_id(cgrp);
+        cgroup_put(cgrp);
+        return 0;
+    }
+#else
+        return -EOPNOTSUPP;
+#endif
+    case RL_SHARE_EXE:
+        key->id = rec->id;
+        key->dev = rec->dev;
+        return 0;
+    }
+    return -EINVAL;
+}
+
+/*
+ * Load a dump: existing tables are overwritten and missing ones created
+ * (within max_policies). When a key appears more than once, the first
+ * record wins. Agents on private tables keep them; only new agents start
+ * from the loaded templates. Caller holds qdump_mutex; may sleep.
+ */
+static int qdump_load(const void *buf, size_t len)
+{
+    const struct rl_qdump_hdr *hdr = buf;
+    unsigned int nq = num_states * NUM_ACTIONS;
+    u32 i, loaded = 0, skipped = 0;
+    unsigned int j;
+
+    if (len < sizeof(*hdr) || hdr->magic != RL_QDUMP_MAGIC) {
+        pr_err("rl_sched_mod: not a Q-table dump\n");
+        return -EINVAL;
+    }
+    if (hdr->version != RL_QDUMP_VERSION) {
+        pr_err("rl_sched_mod: unsupported Q-table dump version %u\n",
+               hdr->version);
+        return -EINVAL;
+    }
+    if (hdr->share != policy_share || hdr->num_states != num_states ||
+        hdr->num_actions != NUM_ACTIONS || hdr->state_sig != state_sig()) {
+        pr_err("rl_sched_mod: Q-table dump is for another configuration (policy_share=%u, %u states)\n",
+               hdr->share, hdr->num_states);
+        return -EINVAL;
+    }
+    if ((len - sizeof(*hdr)) / qdump_rec_len() < hdr->nr_tables) {
+        pr_err("rl_sched_mod: truncated Q-table dump\n");
+        return -EINVAL;
+    }
+
+    qdump_gen++;
+    for (i = 0; i < hdr->nr_tables; i++) {
+        const struct rl_qdump_rec *rec = qdump_rec((void *)buf, i);
+        struct rl_policy_key key;
+        struct rl_policy *pol;
+
+        if (qdump_rec_key(rec, &key)) {
+            skipped++;
+            continue;
+        }
+        pol = rhashtable_lookup_fast(&policy_table, &key, policy_table_params);
+        if (!pol) {
+            pol = policy_alloc(&key, GFP_KERNEL);
+            if (!pol) {
+                skipped++;
+                continue;
+            }
+            strscpy(pol->comm, rec->name, sizeof(pol->comm));
+            strscpy(pol->name, rec->name, sizeof(pol->name));
+            pol = policy_insert(pol);
+            if (!pol) {
+                skipped++;
+                continue;
+            }
+        } else if (pol->load_gen == qdump_gen) {
+            continue;
+        }
+        pol->load_gen = qdump_gen;
+        for (j = 0; j < nq; j++)
+            q_pol_set(pol, j, rec->q[j]);
+        loaded++;
+    }
+    pr_info("rl_sched_mod: loaded %u Q-table(s), skipped %u\n", loaded, skipped);
+    return 0;
+}
+
+/* warm start from the preload file; a bad file only costs the warm start */
+static void qdump_preload(const char *path)
+{
+    void *buf = NULL;
+    size_t size;
+    ssize_t len;
+
+    len = kernel_read_file_from_path(path, 0, &buf, qdump_max_len(), &size,
+                                     READING_UNKNOWN);
+    if (len < 0) {
+        pr_warn("rl_sched_mod: cannot read Q-table dump %s (%zd), starting cold\n",
+                path, len);
+        return;
+    }
+    mutex_lock(&qdump_mutex);
+    if (qdump_load(buf, len))
+        pr_warn("rl_sched_mod: ignoring Q-table dump %s, starting cold\n", path);
+    mutex_unlock(&qdump_mutex);
+    vfree(buf);
+}
+
+/*
+ * debugfs: /sys/kernel/debug/rl_sched/
+ *   tasks   - one block per tracked pid: comm, last state and action, and
+ *             visit count and Q-values of every state it has been in
+ *   stats   - worker counters summed over all shards, and table sizes
+ *   qtables - binary dump of the learned tables; writing a dump loads it
+ *             when the file is closed
+ * Values are read without locking while the workers update them.
+ */
+static struct dentry *rl_debugfs;
+
+static void stats_add(struct rl_stats *sum, const struct rl_stats *st)
+{
+    int i;
+
+    sum->ticks += READ_ONCE(st->ticks);
+    sum->scanned += READ_ONCE(st->scanned);
+    sum->skipped_idle += READ_ONCE(st->skipped_idle);
+    for (i = 0; i < NUM_ACTIONS; i++)
+        sum->actions[i] += READ_ONCE(st->actions[i]);
+    sum->knob_changes += READ_ONCE(st->knob_changes);
+    for (i = 0; i < RL_NR_SUPPRESS; i++)
+        sum->suppressed[i] += READ_ONCE(st->suppressed[i]);
+    for (i = 0; i < RL_TICK_HIST; i++)
+        sum->tick_hist[i] += READ_ONCE(st->tick_hist[i]);
+    for (i = 0; i < RL_NR_PHASES; i++)
+        sum->phase_ns[i] += READ_ONCE(st->phase_ns[i]);
+}
+
+static int stats_show(struct seq_file *m, void *v)
+{
+    struct rl_stats sum = {};
+    int cpu, i;
+
+    stats_add(&sum, &rl_global_shard.stats);
+    if (rl_shards)
+        for_each_possible_cpu(cpu)
+            stats_add(&sum, &per_cpu_ptr(rl_shards, cpu)->stats);
+
+    seq_printf(m, "ticks: %lu\n", sum.ticks);
+    seq_printf(m, "scanned: %lu\n", sum.scanned);
+    seq_printf(m, "skipped_idle: %lu\n", sum.skipped_idle);
+    for (i = 0; i < RL_NR_PHASES; i++)
+        seq_printf(m, "phase_%s_us: %llu\n", rl_phase_names[i],
+                   div_u64(sum.phase_ns[i], NSEC_PER_USEC));
+    for (i = 0; i < NUM_ACTIONS; i++)
+        seq_printf(m, "actions_%s: %lu\n", rl_action_names[i], sum.actions[i]);
+    seq_printf(m, "mode: %s\n", rl_mode_names[READ_ONCE(rl_mode)]);
+    seq_printf(m, "dry_run: %d\n", READ_ONCE(dry_run));
+    seq_printf(m, "knob_changes: %lu\n", sum.knob_changes);
+    for (i = 0; i < RL_NR_SUPPRESS; i++)
+        seq_printf(m, "suppressed_%s: %lu\n", rl_suppress_names[i],
+                   sum.suppressed[i]);
+    seq_printf(m, "tracked: %d/%u\n", atomic_read(&pid_table.nelems), max_entries);
+    seq_printf(m, "policies: %d\n", atomic_read(&policy_table.nelems));
+    seq_printf(m, "groups: %d\n", atomic_read(&group_table.nelems));
+    seq_printf(m, "pool_free: %u\n", READ_ONCE(entry_pool.nr));
+    seq_printf(m, "pool_misses: %ld\n", atomic_long_read(&pool_misses));
+    seq_printf(m, "missed_deadlines: %ld\n", atomic_long_read(&missed_deadlines));
+    seq_printf(m, "actuator: %s\n", rl_actuators[actuator].name);
+    seq_printf(m, "actuate_errors: %ld\n", atomic_long_read(&actuate_errors));
+    seq_printf(m, "sys_pressure_permille: %u\n", READ_ONCE(sys_pressure));
+    seq_printf(m, "effective_interval_us: %llu\n",
+               div_u64(READ_ONCE(effective_interval_ns), NSEC_PER_USEC));
+    if (rl_shards) {
+        seq_puts(m, "shard_tasks:");
+        for_each_online_cpu(cpu)
+            seq_printf(m, " %d:%u", cpu, READ_ONCE(per_cpu_ptr(rl_shards, cpu)->nr));
+        seq_putc(m, '\n');
+    }
+
+    seq_puts(m, "tick_us:\n");
+    seq_printf(m, "  %7s %lu\n", "<1", sum.tick_hist[0]);
+    for (i = 1; i < RL_TICK_HIST - 1; i++)
+        seq_printf(m, "  %7lu %lu\n", 1UL << (i - 1), sum.tick_hist[i]);
+    seq_printf(m, " >=%7lu %lu\n", 1UL << (RL_TICK_HIST - 2),
+               sum.tick_hist[RL_TICK_HIST - 1]);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(stats);
+
+/*
+ * The tasks file walks the pid table. Each record is shown from
+ * rhashtable_walk_peek(), so when seq_file restarts a record that did not
+ * fit the buffer, it gets the same entry again.
+ */
+static void *tasks_start(struct seq_file *m, loff_t *pos)
+{
+    struct rhashtable_iter *iter = m->private;
+    struct pid_entry *pe;
+
+    if (!*pos) {
+        rhashtable_walk_exit(iter);
+        rhashtable_walk_enter(&pid_table, iter);
+    }
+    rhashtable_walk_start(iter);
+    do {
+        pe = rhashtable_walk_peek(iter);
+    } while (PTR_ERR(pe) == -EAGAIN);
+    return IS_ERR(pe) ? NULL : pe;
+}
+
+static void *tasks_next(struct seq_file *m, void *v, loff_t *pos)
+{
+    struct rhashtable_iter *iter = m->private;
+    struct pid_entry *pe;
+
+    ++*pos;
+    do {
+        pe = rhashtable_walk_next(iter);
+    } while (PTR_ERR(pe) == -EAGAIN);
+    return IS_ERR(pe) ? NULL : pe;
+}
+
+static void tasks_stop(struct seq_file *m, void *v)
+{
+    rhashtable_walk_stop(m->private);
+}
+
+/* under rcu_read_lock from rhashtable_walk_start() */
+static int tasks_show(struct seq_file *m, void *v)
+{
+    struct pid_entry *pe = v;
+    struct task_struct *p;
+    u32 idx = pe->idx;
+    const u32 *visits = &rl_store.visits[(size_t)idx * num_states];
+    int st, a;
+
+    p = pid_task(find_pid_ns(pe->pid, &init_pid_ns), PIDTYPE_PID);
+    seq_printf(m, "pid=%d comm=%s state=%u action=%s qtable=%s\n",
+               pe->pid, p ? p->comm : "?",
+               READ_ONCE(rl_store.prev_state[idx]),
+               rl_action_names[READ_ONCE(rl_store.prev_action[idx]) % NUM_ACTIONS],
+               pe->policy ? "shared" : "private");
+    for (st = 0; st < num_states; st++) {
+        u32 n = READ_ONCE(visits[st]);
+
+        if (!n)
+            continue;
+        seq_printf(m, "  s%d visits=%u q=", st, n);
+        for (a = 0; a < NUM_ACTIONS; a++)
+            seq_printf(m, "%s%ld", a ? "," : "", q_get(pe, st, a));
+        seq_putc(m, '\n');
+    }
+    return 0;
+}
+
+static const struct seq_operations tasks_seq_ops = {
+    .start = tasks_start,
+    .next  = tasks_next,
+    .stop  = tasks_stop,
+    .show  = tasks_show,
+};
+
+static int tasks_open(struct inode *inode, struct file *file)
+{
+    struct rhashtable_iter *iter;
+
+    iter = __seq_open_private(file, &tasks_seq_ops, sizeof(*iter));
+    if (!iter)
+        return -ENOMEM;
+    rhashtable_walk_enter(&pid_table, iter);
+    return 0;
+}
+
+static int tasks_release(struct inode *inode, struct file *file)
+{
+    struct seq_file *m = file->private_data;
+
+    rhashtable_walk_exit(m->private);
+    return seq_release_private(inode, file);
+}
+
+static const struct file_operations tasks_fops = {
+    .owner   = THIS_MODULE,
+    .open    = tasks_open,
+    .read    = seq_read,
+    .llseek  = seq_lseek,
+    .release = tasks_release,
+};
+
+/* a dump snapshot being read, or a dump being written */
+struct qtables_buf {
+    void *data;
+    size_t len;
+    size_t cap;
+};
+
+static int qtables_open(struct inode *inode, struct file *file)
+{
+    struct qtables_buf *b;
+
+    if ((file->f_mode & FMODE_READ) && (file->f_mode & FMODE_WRITE))
+        return -EINVAL;
+    b = kzalloc(sizeof(*b), GFP_KERNEL);
+    if (!b)
+        return -ENOMEM;
+    if (file->f_mode & FMODE_READ) {
+        b->data = qdump_build(&b->len);
+        if (!b->data) {
+            kfree(b);
+            return -ENOMEM;
+        }
+    }
+    file->private_data = b;
+    return 0;
+}
+
+static ssize_t qtables_read(struct file *file, char __user *ubuf,
+                            size_t count, loff_t *ppos)
+{
+    struct qtables_buf *b = file->private_data;
+
+    return simple_read_from_buffer(ubuf, count, ppos, b->data, b->len);
+}
+
+/* writes append to a buffer that grows up to qdump_max_len() */
+static ssize_t qtables_write(struct file *file, const char __user *ubuf,
+                             size_t count, loff_t *ppos)
+{
+    struct qtables_buf *b = file->private_data;
+    size_t limit = qdump_max_len();
+
+    if (*ppos != b->len)
+        return -EINVAL;
+    if (count > limit - b->len)
+        return -EFBIG;
+    if (b->len + count > b->cap) {
+        size_t cap = min(max(b->len + count, 2 * b->cap), limit);
+        void *data = vmalloc(cap);
+
+        if (!data)
+            return -ENOMEM;
+        if (b->data)
+            memcpy(data, b->data, b->len);
+        vfree(b->data);
+        b->data = data;
+        b->cap = cap;
+    }
+    if (copy_from_user(b->data + b->len, ubuf, count))
+        return -EFAULT;
+    b->len += count;
+    *ppos += count;
+    return count;
+}
+
+/* a written dump is loaded on close; errors are reported in the log */
+static int qtables_release(struct inode *inode, struct file *file)
+{
+    struct qtables_buf *b = file->private_data;
+
+    if ((file->f_mode & FMODE_WRITE) && b->len) {
+        mutex_lock(&qdump_mutex);
+        qdump_load(b->data, b->len);
+        mutex_unlock(&qdump_mutex);
+    }
+    vfree(b->data);
+    kfree(b);
+    return 0;
+}
+
+static const struct file_operations qtables_fops = {
+    .owner   = THIS_MODULE,
+    .open    = qtables_open,
+    .read    = qtables_read,
+    .write   = qtables_write,
+    .llseek  = default_llseek,
+    .release = qtables_release,
+};
+
+/* debugfs is optional: failures only lose the introspection files */
+static void rl_debugfs_init(void)
+{
+    rl_debugfs = debugfs_create_dir("rl_sched", NULL);
+    debugfs_create_file("tasks", 0400, rl_debugfs, NULL, &tasks_fops);
+    debugfs_create_file("stats", 0444, rl_debugfs, NULL, &stats_fops);
+    debugfs_create_file("qtables", 0600, rl_debugfs, NULL, &qtables_fops);
+}
+
+static void rl_debugfs_exit(void)
+{
+    debugfs_remove_recursive(rl_debugfs);
+    rl_debugfs = NULL;
+}
+
+/* helpers to cleanup entries (no concurrent users left) */
+static void free_shard_entries(struct rl_shard *sh)
+{
+    struct pid_entry *e, *tmp;
+
+    shard_drain_inbox(sh);
+    list_for_each_entry_safe(e, tmp, &sh->entries, shard_node)
+        kmem_cache_free(pid_entry_cache, e);
+    INIT_LIST_HEAD(&sh->entries);
+    sh->nr = 0;
+}
+
+/*
+ * At unload, entries a filter dropped that no worker got to yet still sit
+ * on their shard, out of the table restore_all() walks: put their tasks'
+ * knobs back too. Workers are stopped, so the lists are ours.
+ */
+static void restore_shard_dropped(struct rl_shard *sh)
+{
+    struct pid_entry *e;
+
+    shard_drain_inbox(sh);
+    list_for_each_entry(e, &sh->entries, shard_node) {
+        struct task_struct *p;
+
+        if (!e->dead || !e->has_orig)
+            continue;
+        rcu_read_lock();
+        p = pid_task(find_pid_ns(e->pid, &init_pid_ns), PIDTYPE_PID);
+        /* skip exiting tasks, and those a newer entry took over (exec) */
+        if (p && !(p->flags & PF_EXITING) &&
+            !rhashtable_lookup_fast(&pid_table, &e->pid, pid_table_params))
+            get_task_struct(p);
+        else
+            p = NULL;
+        rcu_read_unlock();
+        if (!p)
+            continue;
+        restore_knob(p, e->orig_val);
+        put_task_struct(p);
+        cond_resched();
+    }
+}
+
+static void restore_all_dropped(void)
+{
+    int cpu;
+
+    restore_shard_dropped(&rl_global_shard);
+    if (rl_shards)
+        for_each_possible_cpu(cpu)
+            restore_shard_dropped(per_cpu_ptr(rl_shards, cpu));
+}
+
+/* the shards own every entry, live or dead; the table only indexes them */
+static void free_all_entries(void)
+{
+    int cpu;
+
+    rhashtable_destroy(&pid_table);
+    free_shard_entries(&rl_global_shard);
+    if (rl_shards)
+        for_each_possible_cpu(cpu)
+            free_shard_entries(per_cpu_ptr(rl_shards, cpu));
+}
+
+static void free_policy(void *ptr, void *arg)
+{
+    kfree(ptr);
+}
+
+static void free_group(void *ptr, void *arg)
+{
+    struct rl_group *g = ptr;
+
+    kfree(g->path);
+    kfree(g);
+}
+
+/* module init/exit */
+static int __init rl_init(void)
+{
+    struct rhashtable_params params = pid_table_params;
+    int ret;
+
+    pr_info("rl_sched_mod: init (algo=%d alpha=%d gamma=%d epsilon=%d interval=%lluus action_step=%d max_entries=%u scope=%d)\n",
+            algo, alpha_permille, gamma_permille, epsilon_permille,
+            div_u64(rl_interval_ns(), NSEC_PER_USEC), action_step,
+            max_entries, scope);
+
+    if (!max_entries)
+        max_entries = 1;
+    rl_start_ns = ktime_get_ns();
+    if (scope < RL_SCOPE_LEADER || scope > RL_SCOPE_PROCESS) {
+        pr_err("rl_sched_mod: invalid scope %d\n", scope);
+        return -EINVAL;
+    }
+    if (algo < 0 || algo >= RL_NR_ALGOS) {
+        pr_err("rl_sched_mod: invalid algo %d\n", algo);
+        return -EINVAL;
+    }
+    q_tables = algo == RL_ALGO_DOUBLE_Q ? 2 : 1;
+    if (policy_share < RL_SHARE_NONE || policy_share > RL_SHARE_EXE) {
+        pr_err("rl_sched_mod: invalid policy_share %d\n", policy_share);
+        return -EINVAL;
+    }
+    if (actuator < 0 || actuator >= RL_NR_ACTUATORS) {
+        pr_err("rl_sched_mod: invalid actuator %d\n", actuator);
+        return -EINVAL;
+    }
+    if (!rl_actuators[actuator].set) {
+        pr_err("rl_sched_mod: %s actuator not supported by this kernel\n",
+               rl_actuators[actuator].name);
+        return -EOPNOTSUPP;
+    }
+    if (group_mode < RL_GROUP_NONE || group_mode > RL_GROUP_AUTOGROUP) {
+        pr_err("rl_sched_mod: invalid group_mode %d\n", group_mode);
+        return -EINVAL;
+    }
+    if ((group_mode == RL_GROUP_CGROUP && !IS_ENABLED(CONFIG_CGROUPS)) ||
+        (group_mode == RL_GROUP_AUTOGROUP && !IS_ENABLED(CONFIG_SCHED_AUTOGROUP))) {
+        pr_err("rl_sched_mod: group_mode %d not supported by this kernel\n",
+               group_mode);
+        return -EOPNOTSUPP;
+    }
+    ret = init_state_space();
+    if (ret)
+        return ret;
+    pr_info("rl_sched_mod: %u states x %d actions\n", num_states, NUM_ACTIONS);
+
+    ret = store_init();
+    if (ret) {
+        pr_err("rl_sched_mod: cannot allocate Q store for %u entries x %u states\n",
+               max_entries, num_states);
+        return ret;
+    }
+
+    shard_init(&rl_global_shard, -1);
+    if (percpu_workers) {
+        int cpu;
+
+        rl_shards = alloc_percpu(struct rl_shard);
+        if (!rl_shards) {
+            ret = -ENOMEM;
+            goto err_store;
+        }
+        for_each_possible_cpu(cpu)
+            shard_init(per_cpu_ptr(rl_shards, cpu), cpu);
+    }
+
+    ret = rhashtable_init(&policy_table, &policy_table_params);
+    if (ret) {
+        pr_err("rl_sched_mod: failed to init policy table\n");
+        goto err_store;
+    }
+    /* before seeding, so the first agents already start from it */
+    if (preload)
+        qdump_preload(preload);
+
+    ret = rhashtable_init(&group_table, &group_table_params);
+    if (ret) {
+        pr_err("rl_sched_mod: failed to init group table\n");
+        goto err_policies;
+    }
+
+    pid_entry_cache = KMEM_CACHE(pid_entry, 0);
+    if (!pid_entry_cache) {
+        pr_err("rl_sched_mod: failed to create pid_entry cache\n");
+        ret = -ENOMEM;
+        goto err_groups;
+    }
+    spin_lock_init(&entry_pool.lock);
+    init_llist_head(&entry_pool.free);
+    pool_refill();
+
+    /* fast-path ops use the const params; only init needs the cap */
+    params.max_size = roundup_pow_of_two(max_entries);
+    ret = rhashtable_init(&pid_table, &params);
+    if (ret) {
+        pr_err("rl_sched_mod: failed to init pid table\n");
+        goto err_pool;
+    }
+
+    effective_interval_ns = rl_interval_ns();
+    ret = rl_sysfs_init();
+    if (ret) {
+        pr_err("rl_sched_mod: failed to create sysfs directory\n");
+        goto err_table;
+    }
+    rl_debugfs_init();
+
+    /* attach before the worker seeds the table so no fork is missed */
+    ret = register_lifecycle_probes();
+    if (ret)
+        goto err_sysfs;
+
+    /* the first worker seeds the table */
+    atomic_set(&resync_needed, 1);
+    ret = rl_workers_start();
+    if (ret) {
+        pr_err("rl_sched_mod: failed to start worker thread(s)\n");
+        goto err_probes;
+    }
+    return 0;
+
+err_probes:
+    unregister_lifecycle_probes();
+err_sysfs:
+    rl_debugfs_exit();
+    rl_sysfs_exit();
+err_table:
+    free_all_entries();
+    rcu_barrier();
+err_pool:
+    pool_drain();
+    kmem_cache_destroy(pid_entry_cache);
+err_groups:
+    rhashtable_free_and_destroy(&group_table, free_group, NULL);
+    rcu_barrier();
+err_policies:
+    rhashtable_free_and_destroy(&policy_table, free_policy, NULL);
+err_store:
+    free_percpu(rl_shards);
+    rl_shards = NULL;
+    store_free();
+    return ret;
+}
+
+static void __exit rl_exit(void)
+{
+    long misses;
+
+    pr_info("rl_sched_mod: exit\n");
+    rl_workers_stop();
+    unregister_lifecycle_probes();
+    rl_debugfs_exit();
+    rl_sysfs_exit();
+
+    /* leave no task at a priority the agents chose */
+    restore_all();
+    restore_all_dropped();
+    free_all_entries();
+    rhashtable_free_and_destroy(&group_table, free_group, NULL);
+    rcu_barrier(); /* wait for call_rcu() frees of removed entries */
+    pool_drain();
+    kmem_cache_destroy(pid_entry_cache);
+    rhashtable_free_and_destroy(&policy_table, free_policy, NULL);
+    free_percpu(rl_shards);
+    store_free();
+    kfree(rcu_dereference_protected(rl_filter, true));
+    if (atomic_long_read(&missed_deadlines))
+        pr_info("rl_sched_mod: %ld tick deadline(s) missed\n",
+                atomic_long_read(&missed_deadlines));
+    misses = atomic_long_read(&pool_misses);
+    if (misses)
+        pr_info("rl_sched_mod: entry pool ran dry %ld times (raise pool_size)\n",
+                misses);
+    pr_info("rl_sched_mod: cleaned up\n");
+}
+
+module_init(rl_init);
+module_exit(rl_exit);
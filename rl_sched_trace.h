@@ -0,0 +1,195 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * rl_sched_trace.h - trace events of the RL scheduler module
+ *
+ * Capture with e.g.:
+ *   trace-cmd record -e rl_sched
+ *   perf record -e 'rl_sched:*' -a
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM rl_sched
+
+#if !defined(_RL_SCHED_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _RL_SCHED_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/sched.h>
+
+/* one interval's observation of a task and the state it maps to */
+TRACE_EVENT(rl_observe,
+
+    TP_PROTO(pid_t pid, int state, u64 cpu_ns, u64 wait_ns, u64 vcsw,
+             u64 ivcsw, u64 util, long reward),
+
+    TP_ARGS(pid, state, cpu_ns, wait_ns, vcsw, ivcsw, util, reward),
+
+    TP_STRUCT__entry(
+        __field(pid_t, pid)
+        __field(int, state)
+        __field(u64, cpu_ns)
+        __field(u64, wait_ns)
+        __field(u64, vcsw)
+        __field(u64, ivcsw)
+        __field(u64, util)
+        __field(long, reward)
+    ),
+
+    TP_fast_assign(
+        __entry->pid = pid;
+        __entry->state = state;
+        __entry->cpu_ns = cpu_ns;
+        __entry->wait_ns = wait_ns;
+        __entry->vcsw = vcsw;
+        __entry->ivcsw = ivcsw;
+        __entry->util = util;
+        __entry->reward = reward;
+    ),
+
+    TP_printk("pid=%d state=%d cpu_ns=%llu wait_ns=%llu vcsw=%llu ivcsw=%llu util=%llu reward=%ld",
+              __entry->pid, __entry->state, __entry->cpu_ns, __entry->wait_ns,
+              __entry->vcsw, __entry->ivcsw, __entry->util, __entry->reward)
+);
+
+/* epsilon-greedy choice for a state */
+TRACE_EVENT(rl_choose,
+
+    TP_PROTO(pid_t pid, int state, int action, bool explore, long q),
+
+    TP_ARGS(pid, state, action, explore, q),
+
+    TP_STRUCT__entry(
+        __field(pid_t, pid)
+        __field(int, state)
+        __field(int, action)
+        __field(bool, explore)
+        __field(long, q)
+    ),
+
+    TP_fast_assign(
+        __entry->pid = pid;
+        __entry->state = state;
+        __entry->action = action;
+        __entry->explore = explore;
+        __entry->q = q;
+    ),
+
+    TP_printk("pid=%d state=%d action=%d explore=%d q=%ld",
+              __entry->pid, __entry->state, __entry->action,
+              __entry->explore, __entry->q)
+);
+
+/* Q(s, a) moved by delta towards its TD target (per the algo parameter) */
+TRACE_EVENT(rl_q_update,
+
+    TP_PROTO(pid_t pid, int s, int a, long reward, int s_next, long q,
+             long delta),
+
+    TP_ARGS(pid, s, a, reward, s_next, q, delta),
+
+    TP_STRUCT__entry(
+        __field(pid_t, pid)
+        __field(int, s)
+        __field(int, a)
+        __field(long, reward)
+        __field(int, s_next)
+        __field(long, q)
+        __field(long, delta)
+    ),
+
+    TP_fast_assign(
+        __entry->pid = pid;
+        __entry->s = s;
+        __entry->a = a;
+        __entry->reward = reward;
+        __entry->s_next = s_next;
+        __entry->q = q;
+        __entry->delta = delta;
+    ),
+
+    TP_printk("pid=%d s=%d a=%d reward=%ld s_next=%d q=%ld delta=%ld",
+              __entry->pid, __entry->s, __entry->a, __entry->reward,
+              __entry->s_next, __entry->q, __entry->delta)
+);
+
+/*
+ * an actuator moved a task's knob (nice, cpu.weight, policy, uclamp), or
+ * in dry_run mode would have
+ */
+TRACE_EVENT(rl_actuate,
+
+    TP_PROTO(struct task_struct *p, int actuator, int action,
+             long old_val, long new_val, bool dry_run),
+
+    TP_ARGS(p, actuator, action, old_val, new_val, dry_run),
+
+    TP_STRUCT__entry(
+        __field(pid_t, pid)
+        __array(char, comm, TASK_COMM_LEN)
+        __field(int, actuator)
+        __field(int, action)
+        __field(long, old_val)
+        __field(long, new_val)
+        __field(bool, dry_run)
+    ),
+
+    TP_fast_assign(
+        __entry->pid = p->pid;
+        memcpy(__entry->comm, p->comm, TASK_COMM_LEN);
+        __entry->actuator = actuator;
+        __entry->action = action;
+        __entry->old_val = old_val;
+        __entry->new_val = new_val;
+        __entry->dry_run = dry_run;
+    ),
+
+    TP_printk("pid=%d comm=%s actuator=%s action=%d %ld->%ld dry_run=%d",
+              __entry->pid, __entry->comm,
+              __print_symbolic(__entry->actuator, { 0, "nice" }, { 1, "weight" },
+                               { 2, "policy" }, { 3, "uclamp" }),
+              __entry->action, __entry->old_val, __entry->new_val,
+              __entry->dry_run)
+);
+
+/* a group agent moved its group's knob, or in dry_run mode would have */
+TRACE_EVENT(rl_group_actuate,
+
+    TP_PROTO(u64 key, int group_mode, int action, long old_val, long new_val,
+             bool dry_run),
+
+    TP_ARGS(key, group_mode, action, old_val, new_val, dry_run),
+
+    TP_STRUCT__entry(
+        __field(u64, key)
+        __field(int, group_mode)
+        __field(int, action)
+        __field(long, old_val)
+        __field(long, new_val)
+        __field(bool, dry_run)
+    ),
+
+    TP_fast_assign(
+        __entry->key = key;
+        __entry->group_mode = group_mode;
+        __entry->action = action;
+        __entry->old_val = old_val;
+        __entry->new_val = new_val;
+        __entry->dry_run = dry_run;
+    ),
+
+    TP_printk("group=%s key=%llx action=%d %ld->%ld dry_run=%d",
+              __print_symbolic(__entry->group_mode, { 1, "cgroup" },
+                               { 2, "autogroup" }),
+              __entry->key, __entry->action, __entry->old_val,
+              __entry->new_val, __entry->dry_run)
+);
+
+#endif /* _RL_SCHED_TRACE_H */
+
+/* out-of-tree: the header sits next to the module source */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE rl_sched_trace
+
+#include <trace/define_trace.h>
@@ -1,6 +1,6 @@
 #!/bin/bash
 # run_single_test.sh <mode> <outdir>
-# mode: baseline | rl
+# mode: baseline | rl | shadow (rl with dry_run=1: learns, changes nothing)
 MODE=${1:-baseline}
 OUT=${2:-./results_${MODE}}
 DURATION=60    # total duration (we will split in two episodes)
@@ -20,13 +20,25 @@ sudo dmesg -C
 if [ "$MODE" = "baseline" ]; then
   sudo rmmod rl_sched_mod 2>/dev/null || true
 else
+  DRY_RUN=0
+  [ "$MODE" = "shadow" ] && DRY_RUN=1
   # insert module if not present
   if ! lsmod | grep -q rl_sched_mod; then
-    sudo insmod ./rl_sched_mod.ko alpha_permille=200 gamma_permille=900 epsilon_permille=300 interval_ms=1000 action_step=5
+    sudo insmod ./rl_sched_mod.ko alpha_permille=200 gamma_permille=900 epsilon_permille=300 interval_ms=1000 action_step=5 dry_run=$DRY_RUN
     sleep 1
+  else
+    echo $DRY_RUN | sudo tee /sys/module/rl_sched_mod/parameters/dry_run > /dev/null
   fi
 fi
 
+# RL decisions go to the rl_sched trace events, not dmesg
+TRACEFS=/sys/kernel/tracing
+[ -d "$TRACEFS/events" ] || TRACEFS=/sys/kernel/debug/tracing
+if [ "$MODE" != "baseline" ] && [ -d "$TRACEFS/events/rl_sched" ]; then
+  echo | sudo tee "$TRACEFS/trace" > /dev/null
+  echo 1 | sudo tee "$TRACEFS/events/rl_sched/enable" > /dev/null
+fi
+
 # Start pidstat to capture system CPU per second
 pidstat -u 1 > "$OUT/pidstat_${MODE}.log" 2>&1 &
 PIDSTAT_PID=$!
@@ -79,7 +91,18 @@ fi
 kill $PIDSTAT_PID 2>/dev/null || true
 wait $PIDSTAT_PID 2>/dev/null || true
 
-# capture dmesg lines for RL actions and any module log messages
+# capture RL decisions from the trace buffer
+if [ "$MODE" != "baseline" ] && [ -d "$TRACEFS/events/rl_sched" ]; then
+  echo 0 | sudo tee "$TRACEFS/events/rl_sched/enable" > /dev/null
+  sudo cat "$TRACEFS/trace" > "$OUT/trace_rl_${MODE}.log" || true
+fi
+
+# worker cost (phase timings) and decision counts, to compare rl and shadow runs
+if [ "$MODE" != "baseline" ]; then
+  sudo cat /sys/kernel/debug/rl_sched/stats > "$OUT/stats_rl_${MODE}.txt" 2>/dev/null || true
+fi
+
+# capture module log messages (nice changes only with debug=1)
 dmesg | grep rl_sched_mod > "$OUT/dmesg_rl_${MODE}.log" || true
 dmesg > "$OUT/dmesg_all_${MODE}.log" || true
 